@@ -0,0 +1,311 @@
+// console program that times the renderer without a window, it compares the
+// exact and fast math (see FAST_MATH in raytrace_math.c) and the per pixel,
+// batched (see shade.c) and wavefront (see wavefront.c) renderers
+//
+//     benchmark [width height]
+//     benchmark samplers [width height]
+//     benchmark threads [width height]
+//
+// with samplers it measures how fast each sampler (see sampler.c) gets
+// close to the real image instead: the error against a reference with lots
+// of samples per pixel, for more and more rays per pixel. the last column
+// is sobol run through the denoiser (see denoise.c). it's a small image by
+// default (160 x 90) because the reference takes a while
+//
+// with threads it times the progressive renderer (see progressive.c) with
+// more and more threads, once letting them go anywhere and once with them
+// kept on cpus spread over the numa nodes, each doing its own node's part of
+// the image. the difference only shows up on machines with more than one
+// numa node
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "render.c"
+#include "denoise.c"
+#include "progressive.c"
+
+double seconds_now () {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+void render_image (const Render_State *state, u32 *image, int width, int height) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            image[y * width + x] = color_to_pixel(trace_pixel(state, x, y, width, height, 1));
+        }
+    }
+}
+
+// same image but through the batched shading kernels, a row at a time
+void render_image_batched (const Render_State *state, u32 *image, Color *row, int width, int height) {
+    for (int y = 0; y < height; y++) {
+        trace_block(state, row, 0, y, width, 1, width, height, 1);
+        for (int x = 0; x < width; x++) image[y * width + x] = color_to_pixel(row[x]);
+    }
+}
+
+// a primary hit saved so we can time just the shading part
+typedef struct Bench_Hit {
+    Ray sight;
+    Vector3 point;
+    Vector3 normal;
+    int object;
+} Bench_Hit;
+
+int collect_hits (const Render_State *state, Bench_Hit *hits, int width, int height) {
+    int count = 0;
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            Ray sight = primary_ray(state, x, y, width, height, 0, 1);
+
+            float hit;
+            Bench_Hit *h = &hits[count];
+            if (intersect_scene(state, sight, 0.0f, INFINITY, &hit, &h->object, &h->normal)) {
+                h->sight = sight;
+                h->point = parametric_line(hit, sight);
+                count++;
+            }
+        }
+    }
+
+    return count;
+}
+
+// error of an image against the reference in 0-255 units, per channel
+void image_error (u32 *image, u32 *reference, int count, double *rmse, int *max_error) {
+    double sum = 0.0;
+    int max = 0;
+
+    for (int i = 0; i < count; i++) {
+        for (int shift = 0; shift < 24; shift += 8) {
+            int a = (image[i] >> shift) & 255;
+            int b = (reference[i] >> shift) & 255;
+            int diff = abs(a - b);
+
+            sum += diff * diff;
+            if (diff > max) max = diff;
+        }
+    }
+
+    *rmse = sqrt(sum / (count * 3.0));
+    *max_error = max;
+}
+
+// same as image_error but for float colors, before they get rounded to
+// bytes, so small differences between samplers still show up
+double color_rmse (Color *image, Color *reference, int count) {
+    double sum = 0.0;
+    for (int i = 0; i < count; i++) {
+        double r = (image[i].r - reference[i].r) * 255.0;
+        double g = (image[i].g - reference[i].g) * 255.0;
+        double b = (image[i].b - reference[i].b) * 255.0;
+        sum += r * r + g * g + b * b;
+    }
+    return sqrt(sum / (count * 3.0));
+}
+
+#define REFERENCE_SAMPLES 16
+#define MAX_CURVE_SAMPLES 6
+
+int benchmark_samplers (Render_State *state, int width, int height) {
+    int pixel_count = width * height;
+    Color *reference = malloc(pixel_count * sizeof(Color));
+    Color *colors = malloc(pixel_count * sizeof(Color));
+
+    // jittered with lots of samples gets close enough to the real thing
+    state->sampler = SAMPLER_JITTER;
+    double start = seconds_now();
+    trace_block(state, reference, 0, 0, width, height, width, height, REFERENCE_SAMPLES);
+    double reference_time = seconds_now() - start;
+
+    printf("%d x %d, reference %d rays per pixel took %.1f s\n\n",
+        width, height, REFERENCE_SAMPLES * REFERENCE_SAMPLES, reference_time);
+
+    printf("rmse against the reference\n");
+    printf("rays/pixel");
+    for (int s = 0; s < SAMPLER_COUNT; s++) printf(" %8s", sampler_names[s]);
+    printf(" denoised\n");
+
+    for (int samples = 1; samples <= MAX_CURVE_SAMPLES; samples++) {
+        printf("%10d", samples * samples);
+        for (int s = 0; s < SAMPLER_COUNT; s++) {
+            state->sampler = s;
+            trace_block(state, colors, 0, 0, width, height, width, height, samples);
+            printf(" %8.3f", color_rmse(colors, reference, pixel_count));
+        }
+
+        state->sampler = SAMPLER_SOBOL;
+        trace_block(state, colors, 0, 0, width, height, width, height, samples);
+        denoise_frame(state, colors, width, height, samples, cpu_count());
+        printf(" %8.3f\n", color_rmse(colors, reference, pixel_count));
+    }
+
+    state->sampler = SAMPLER_GRID;
+    free(reference);
+    free(colors);
+    return 0;
+}
+
+#define BENCHMARK_CHECKPOINT "benchmark.ckpt"
+
+double time_progressive (const Render_State *state, int width, int height, int threads, bool numa) {
+    double start = seconds_now();
+    // the checkpoint never gets saved, it's too long between them
+    Color *colors = render_progressive(
+        state, width, height, 1, PROGRESSIVE_TILE_SIZE, threads, BENCHMARK_CHECKPOINT, 1 << 20, false, numa
+    );
+    double time = seconds_now() - start;
+    free(colors);
+    return time;
+}
+
+int benchmark_threads (const Render_State *state, int width, int height) {
+    Cpu_Layout *layout = malloc(sizeof(Cpu_Layout));
+    cpu_layout(layout);
+    printf("%d x %d, %d cpus on %d numa nodes\n\n", width, height, layout->cpu_count, layout->node_count);
+
+    printf("threads   anywhere ms   speedup   placed ms   speedup\n");
+
+    double one_thread = 0.0;
+    for (int threads = 1; ; threads *= 2) {
+        if (threads > layout->cpu_count) threads = layout->cpu_count;
+
+        double anywhere = time_progressive(state, width, height, threads, false);
+        double placed = time_progressive(state, width, height, threads, true);
+        if (threads == 1) one_thread = anywhere;
+
+        printf("%7d %13.1f %9.2f %11.1f %9.2f\n",
+            threads, anywhere * 1000.0, one_thread / anywhere, placed * 1000.0, one_thread / placed);
+
+        if (threads == layout->cpu_count) break;
+    }
+
+    free(layout);
+    return 0;
+}
+
+int main (int argc, char **argv) {
+    Render_State state = DEFAULT_RENDER_STATE;
+    setup_scene(&state);
+
+    if (argc >= 2 && strcmp(argv[1], "samplers") == 0) {
+        int width = 160;
+        int height = 90;
+        if (argc >= 4) {
+            width = atoi(argv[2]);
+            height = atoi(argv[3]);
+        }
+        return benchmark_samplers(&state, width, height);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "threads") == 0) {
+        int width = 1280;
+        int height = 720;
+        if (argc >= 4) {
+            width = atoi(argv[2]);
+            height = atoi(argv[3]);
+        }
+        return benchmark_threads(&state, width, height);
+    }
+
+    int width = 640;
+    int height = 360;
+    if (argc >= 3) {
+        width = atoi(argv[1]);
+        height = atoi(argv[2]);
+    }
+
+    int pixel_count = width * height;
+    u32 *reference = malloc(pixel_count * sizeof(u32));
+    u32 *image = malloc(pixel_count * sizeof(u32));
+    Bench_Hit *hits = malloc(pixel_count * sizeof(Bench_Hit));
+
+    state.fast_math = 0;
+    int hit_count = collect_hits(&state, hits, width, height);
+
+    printf("%d x %d, %d primary hits\n\n", width, height, hit_count);
+    printf("fast_math   frame ms   Mpixel/s   Mshade/s   rmse   max err\n");
+
+    for (int level = 0; level <= 2; level++) {
+        state.fast_math = level;
+
+        u32 *target = (level == 0) ? reference : image;
+
+        double start = seconds_now();
+        render_image(&state, target, width, height);
+        double frame_time = seconds_now() - start;
+
+        // shade every saved hit a few times so the timing is stable
+        int rounds = 4;
+        float sink = 0.0f;
+        start = seconds_now();
+        for (int round = 0; round < rounds; round++) {
+            for (int i = 0; i < hit_count; i++) {
+                Bench_Hit h = hits[i];
+                Color base = object_material(&state, state.scene[h.object], h.point).color;
+                Color c = color_from_all_lights(&state, h.object, h.point, h.normal, h.sight, base);
+                sink += c.r;
+            }
+        }
+        double shade_time = seconds_now() - start;
+
+        double rmse = 0.0;
+        int max_error = 0;
+        if (level > 0) image_error(image, reference, pixel_count, &rmse, &max_error);
+
+        printf("%9d %10.1f %10.2f %10.2f %6.3f %9d\n",
+            level,
+            frame_time * 1000.0,
+            pixel_count / frame_time / 1e6,
+            (double) hit_count * rounds / shade_time / 1e6,
+            rmse, max_error
+        );
+
+        if (sink < 0.0f) printf("\n"); // keeps the shading loop from being optimized out
+    }
+
+    // per pixel ray_color against the batched material kernels
+    state.fast_math = 0;
+    Color *row = malloc(width * sizeof(Color));
+
+    double start = seconds_now();
+    render_image(&state, reference, width, height);
+    double pixel_time = seconds_now() - start;
+
+    start = seconds_now();
+    render_image_batched(&state, image, row, width, height);
+    double batched_time = seconds_now() - start;
+
+    double rmse;
+    int max_error;
+    image_error(image, reference, pixel_count, &rmse, &max_error);
+
+    printf("\nshading      frame ms   Mpixel/s   rmse   max err\n");
+    printf("per pixel  %10.1f %10.2f\n", pixel_time * 1000.0, pixel_count / pixel_time / 1e6);
+    printf("batched    %10.1f %10.2f %6.3f %9d\n",
+        batched_time * 1000.0, pixel_count / batched_time / 1e6, rmse, max_error);
+
+    Color *colors = malloc(pixel_count * sizeof(Color));
+
+    start = seconds_now();
+    trace_wavefront(&state, colors, 0, 0, width, height, width, height, 1);
+    double wavefront_time = seconds_now() - start;
+
+    for (int i = 0; i < pixel_count; i++) image[i] = color_to_pixel(colors[i]);
+    image_error(image, reference, pixel_count, &rmse, &max_error);
+
+    printf("wavefront  %10.1f %10.2f %6.3f %9d\n",
+        wavefront_time * 1000.0, pixel_count / wavefront_time / 1e6, rmse, max_error);
+
+    free(colors);
+    free(row);
+    free(reference);
+    free(image);
+    free(hits);
+
+    return 0;
+}
@@ -1 +1,23 @@
-cl /fp:fast raytrace.c user32.lib gdi32.lib
+@echo off
+
+rem "build simd" uses the sse math from raytrace_simd.c, this needs the x64 tools
+rem because x86 msvc can't pass 16 byte aligned vectors by value
+rem "build bench" builds the console benchmark, "build headless" the windowless renderer
+rem "build check" builds the golden image check (see check.c), run it from here
+rem "build lib" makes raytrace.lib (see raytrace.h) and embed.exe which uses it
+rem (see the Makefile for linux). lib can't hide symbols the way the Makefile does
+rem with objcopy, so the tracer's internals (vec3_add, mutex_lock...) stay visible
+rem in raytrace.lib and can clash with the program's own
+if "%1"=="simd" (
+    cl /fp:fast /O2 /DRAYTRACE_SIMD raytrace.c user32.lib gdi32.lib
+) else if "%1"=="bench" (
+    cl /fp:fast /O2 benchmark.c
+) else if "%1"=="headless" (
+    cl /fp:fast /O2 headless.c
+) else if "%1"=="check" (
+    cl /fp:fast /O2 check.c
+) else if "%1"=="lib" (
+    cl /c /fp:fast /O2 library.c && lib /out:raytrace.lib library.obj && cl /O2 embed.c raytrace.lib
+) else (
+    cl /fp:fast raytrace.c user32.lib gdi32.lib
+)
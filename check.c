@@ -0,0 +1,520 @@
+// console program that renders a few reference images and compares them with
+// the ones in golden/, so a change to the tracer can't quietly change the
+// picture or make it slower. make check runs it
+//
+//     check [-g golden_dir] [-b baseline] [-p percent] [-f fast_math] [-u 0|1]
+//     check math
+//
+// each case in check_cases is the scene traced a different way and gets
+// compared with golden/<name>.hdr. the images don't have to be the same to
+// the bit, fast_math, the sse math (see raytrace_simd.c) and different
+// compilers all move colors a little and can flip a pixel on the edge of a
+// sphere. so both images get turned into cie lab and a pixel only counts as
+// different if it's more than CHECK_VISIBLE_DE apart (a difference people
+// can just about see), and a case fails if more than CHECK_MAX_DIFFERENT of
+// its pixels are or the average is over CHECK_MAX_MEAN_DE
+//
+// it also times every case in camera rays per second and fails if one got
+// more than -p percent (CHECK_SLOWDOWN by default) slower than in the -b
+// file. the golden images are too small to time, a render takes a few
+// milliseconds and one hiccup is more than 15%, so the timing is done with
+// CHECK_TIME_WIDTH x CHECK_TIME_HEIGHT camera rays instead (the frame gets
+// smaller by the samples per side, so every case traces about as many). it's
+// the median of CHECK_RUNS, and how far apart the middle half of the runs are gets added
+// to -p, so a case only fails when it's slower by more than the noise too.
+// speed depends on the machine and the build, so that file isn't in golden/,
+// the Makefile keeps one per build directory. when it's not there the times
+// get written to it and nothing is compared
+//
+// -u 1 writes the images to golden/ and the times to the -b file instead of
+// checking them, for when the picture is meant to change. -f checks with
+// fast_math (see raytrace_math.c), the golden images are made without it
+//
+// check math compares the vector and color functions with doubles instead
+// (see check_math), make check runs both
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "render.c"
+#include "output.c"
+#include "encoder.c"
+
+#define CHECK_WIDTH 160
+#define CHECK_HEIGHT 90
+#define CHECK_TIME_WIDTH 320
+#define CHECK_TIME_HEIGHT 180
+#define CHECK_RUNS 7
+#define CHECK_SLOWDOWN 15.0
+
+#define CHECK_VISIBLE_DE 2.3
+#define CHECK_MAX_DIFFERENT 0.005
+#define CHECK_MAX_MEAN_DE 0.5
+
+typedef struct Check_Case {
+    const char *name;
+    int samples;
+    Sampler sampler;
+    float light_size;
+    bool hdr;
+    bool wavefront;
+} Check_Case;
+
+Check_Case check_cases[] = {
+    {"plain", 1, SAMPLER_GRID, 0.0f, false, false},
+    {"wavefront", 1, SAMPLER_GRID, 0.0f, false, true},
+    {"jitter", 3, SAMPLER_JITTER, 0.0f, false, false},
+    {"soft", 2, SAMPLER_SOBOL, 0.5f, false, false},
+    {"hdr", 2, SAMPLER_HALTON, 0.0f, true, false},
+};
+
+double seconds_now () {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+// base with the case's settings
+Render_State check_state (const Render_State *base, Check_Case c) {
+    Render_State state = *base;
+    state.sampler = c.sampler;
+    state.light_size = c.light_size;
+    state.hdr = c.hdr;
+    setup_scene(&state); // the lights depend on light_size
+    return state;
+}
+
+void check_render (const Render_State *state, Check_Case c, Color *colors, int width, int height) {
+    if (c.wavefront) {
+        trace_wavefront(state, colors, 0, 0, width, height, width, height, c.samples);
+    } else {
+        trace_block(state, colors, 0, 0, width, height, width, height, c.samples);
+    }
+}
+
+int compare_doubles (const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// traces the case CHECK_RUNS times at width x height, gives back the median
+// in seconds and in noise how far apart the middle half of the runs were, as
+// a share of the median
+double check_time (const Render_State *state, Check_Case c, int width, int height, double *noise) {
+    Color *colors = malloc((size_t) width * height * sizeof(Color));
+    double times[CHECK_RUNS];
+    for (int run = 0; run < CHECK_RUNS; run++) {
+        double start = seconds_now();
+        check_render(state, c, colors, width, height);
+        times[run] = seconds_now() - start;
+    }
+    free(colors);
+
+    qsort(times, CHECK_RUNS, sizeof(double), compare_doubles);
+    double median = times[CHECK_RUNS / 2];
+    *noise = (times[CHECK_RUNS - 1 - CHECK_RUNS / 4] - times[CHECK_RUNS / 4]) / median;
+    return median;
+}
+
+// the tracer's colors are what ends up on the screen (color_to_pixel doesn't
+// do any gamma), so they're taken as srgb
+void color_to_lab (Color color, float *lab) {
+    float rgb[3] = {color.r, color.g, color.b};
+    for (int i = 0; i < 3; i++) {
+        float x = fminf(fmaxf(rgb[i], 0.0f), 1.0f);
+        rgb[i] = x <= 0.04045f ? x / 12.92f : powf((x + 0.055f) / 1.055f, 2.4f);
+    }
+
+    // d65 white
+    float xyz[3] = {
+        (0.4124f * rgb[0] + 0.3576f * rgb[1] + 0.1805f * rgb[2]) / 0.95047f,
+        (0.2126f * rgb[0] + 0.7152f * rgb[1] + 0.0722f * rgb[2]),
+        (0.0193f * rgb[0] + 0.1192f * rgb[1] + 0.9505f * rgb[2]) / 1.08883f
+    };
+    for (int i = 0; i < 3; i++) {
+        float t = xyz[i];
+        xyz[i] = t > 0.008856f ? cbrtf(t) : 7.787f * t + 16.0f / 116.0f;
+    }
+
+    lab[0] = 116.0f * xyz[1] - 16.0f;
+    lab[1] = 500.0f * (xyz[0] - xyz[1]);
+    lab[2] = 200.0f * (xyz[1] - xyz[2]);
+}
+
+typedef struct Image_Difference {
+    double mean_de;
+    double different; // share of the pixels more than CHECK_VISIBLE_DE apart
+    double max_de;
+    int max_x;
+    int max_y;
+} Image_Difference;
+
+// with hdr the colors can go past 1, those get compared at a quarter of the
+// brightness so the bright parts still count
+Image_Difference image_difference (Color *image, Color *golden, int width, int height, bool hdr_colors) {
+    Image_Difference d = {0};
+    int different = 0;
+    float scale = hdr_colors ? 0.25f : 1.0f;
+
+    for (int i = 0; i < width * height; i++) {
+        float a[3], b[3];
+        color_to_lab(color_scale(image[i], scale), a);
+        color_to_lab(color_scale(golden[i], scale), b);
+
+        double de = sqrt(
+            (a[0] - b[0]) * (a[0] - b[0]) + (a[1] - b[1]) * (a[1] - b[1]) + (a[2] - b[2]) * (a[2] - b[2])
+        );
+
+        d.mean_de += de;
+        if (de > CHECK_VISIBLE_DE) different++;
+        if (de > d.max_de) {
+            d.max_de = de;
+            d.max_x = i % width;
+            d.max_y = i / width;
+        }
+    }
+
+    d.mean_de /= width * height;
+    d.different = (double) different / (width * height);
+    return d;
+}
+
+bool write_golden (const char *path, Color *colors, int width, int height) {
+    Tonemap tonemap;
+    tonemap_init(&tonemap, 0.0f, TONEMAP_CLAMP, 1.0f);
+
+    Image_Encoder *encoder = image_encoder_open(path, IMAGE_HDR, width, height, &tonemap, 1);
+    if (!encoder) return false;
+    image_encoder_rows(encoder, colors, height);
+    return image_encoder_close(encoder);
+}
+
+// the -b file is a line per case with its name and camera rays per second,
+// 0 for a case that isn't in it
+double baseline_rays (const char *path, const char *name) {
+    FILE *file = fopen(path, "r");
+    if (!file) return 0.0;
+
+    char line_name[64];
+    double rays;
+    double found = 0.0;
+    while (fscanf(file, "%63s %lf", line_name, &rays) == 2) {
+        if (strcmp(line_name, name) == 0) found = rays;
+    }
+
+    fclose(file);
+    return found;
+}
+
+// check math: the vector and color functions against the same thing done in
+// doubles, over lots of random inputs from tiny to big. in a SIMD=1 build
+// those are the sse ones (see raytrace_simd.c), so this is how to tell they
+// still do what the plain ones do. the errors are relative to how big the
+// inputs are, a few float ulps is fine. normalize and fast_rsqrt only get
+// about 22 bits from rsqrt and a newton step, so they get more room
+
+#define CHECK_MATH_INPUTS 200000
+#define CHECK_MATH_ULPS 4e-7
+#define CHECK_MATH_RSQRT 1e-6
+
+typedef struct Math_Error {
+    const char *name;
+    double bound;
+    double max;
+} Math_Error;
+
+typedef enum Math_Op {
+    MATH_VEC3_ADD,
+    MATH_VEC3_SUB,
+    MATH_VEC3_MUL,
+    MATH_VEC3_DIV,
+    MATH_VEC3_DOT,
+    MATH_VEC3_CROSS,
+    MATH_VEC3_NORMALIZE,
+    MATH_COLOR_ADD,
+    MATH_COLOR_SUM,
+    MATH_COLOR_MUL,
+    MATH_COLOR_SCALE,
+    MATH_COLOR_LERP,
+    MATH_FAST_RSQRT,
+    MATH_OP_COUNT
+} Math_Op;
+
+u32 math_random_state = 12345;
+
+// xorshift, the same inputs every run
+float math_random (float lo, float hi) {
+    math_random_state ^= math_random_state << 13;
+    math_random_state ^= math_random_state >> 17;
+    math_random_state ^= math_random_state << 5;
+    return lo + (hi - lo) * (float) (math_random_state >> 8) / (float) (1 << 24);
+}
+
+// a number from about 1e-3 to 1e3 either way, so every exponent gets tried
+float math_random_float () {
+    float x = powf(10.0f, math_random(-3.0f, 3.0f));
+    return math_random(0.0f, 1.0f) < 0.5f ? -x : x;
+}
+
+double length3 (double x, double y, double z) {
+    return sqrt(x * x + y * y + z * z);
+}
+
+// the biggest difference in the three lanes over scale
+double lane_error (float *got, double *want, double scale) {
+    double error = 0.0;
+    for (int i = 0; i < 3; i++) error = fmax(error, fabs(got[i] - want[i]) / scale);
+    return error;
+}
+
+void math_record (Math_Error *errors, Math_Op op, double error) {
+    // a nan anywhere is as wrong as it gets
+    if (!(error <= errors[op].max)) errors[op].max = isnan(error) ? INFINITY : fmax(errors[op].max, error);
+}
+
+int check_math () {
+    Math_Error errors[MATH_OP_COUNT] = {
+        [MATH_VEC3_ADD]       = {"vec3_add", CHECK_MATH_ULPS},
+        [MATH_VEC3_SUB]       = {"vec3_sub", CHECK_MATH_ULPS},
+        [MATH_VEC3_MUL]       = {"vec3_mul", CHECK_MATH_ULPS},
+        [MATH_VEC3_DIV]       = {"vec3_div", CHECK_MATH_ULPS},
+        [MATH_VEC3_DOT]       = {"vec3_dot", CHECK_MATH_ULPS},
+        [MATH_VEC3_CROSS]     = {"vec3_cross", CHECK_MATH_ULPS},
+        [MATH_VEC3_NORMALIZE] = {"vec3_normalize", CHECK_MATH_RSQRT},
+        [MATH_COLOR_ADD]      = {"color_add", CHECK_MATH_ULPS},
+        [MATH_COLOR_SUM]      = {"color_sum", CHECK_MATH_ULPS},
+        [MATH_COLOR_MUL]      = {"color_mul", CHECK_MATH_ULPS},
+        [MATH_COLOR_SCALE]    = {"color_scale", CHECK_MATH_ULPS},
+        [MATH_COLOR_LERP]     = {"color_lerp", CHECK_MATH_ULPS},
+        [MATH_FAST_RSQRT]     = {"fast_rsqrt", CHECK_MATH_RSQRT},
+    };
+    bool padding_ok = true;
+
+    for (int n = 0; n < CHECK_MATH_INPUTS; n++) {
+        float a[3], b[3];
+        for (int i = 0; i < 3; i++) {
+            a[i] = math_random_float();
+            b[i] = math_random_float();
+        }
+        float k = math_random_float();
+        float alpha = math_random(0.0f, 1.0f);
+
+        double a_length = length3(a[0], a[1], a[2]);
+        double b_length = length3(b[0], b[1], b[2]);
+        double want[3];
+        Vector3 va = {a[0], a[1], a[2]};
+        Vector3 vb = {b[0], b[1], b[2]};
+        Vector3 v;
+
+        v = vec3_add(va, vb);
+        for (int i = 0; i < 3; i++) want[i] = (double) a[i] + b[i];
+        math_record(errors, MATH_VEC3_ADD, lane_error(&v.x, want, a_length + b_length));
+
+        v = vec3_sub(va, vb);
+        for (int i = 0; i < 3; i++) want[i] = (double) a[i] - b[i];
+        math_record(errors, MATH_VEC3_SUB, lane_error(&v.x, want, a_length + b_length));
+
+        v = vec3_mul(va, k);
+        for (int i = 0; i < 3; i++) want[i] = (double) a[i] * k;
+        math_record(errors, MATH_VEC3_MUL, lane_error(&v.x, want, a_length * fabs(k)));
+
+        v = vec3_div(va, k);
+        for (int i = 0; i < 3; i++) want[i] = (double) a[i] / k;
+        math_record(errors, MATH_VEC3_DIV, lane_error(&v.x, want, a_length / fabs(k)));
+
+        double dot = (double) a[0] * b[0] + (double) a[1] * b[1] + (double) a[2] * b[2];
+        math_record(errors, MATH_VEC3_DOT, fabs(vec3_dot(va, vb) - dot) / (a_length * b_length));
+
+        v = vec3_cross(va, vb);
+        want[0] = (double) a[1] * b[2] - (double) a[2] * b[1];
+        want[1] = (double) a[2] * b[0] - (double) a[0] * b[2];
+        want[2] = (double) a[0] * b[1] - (double) a[1] * b[0];
+        math_record(errors, MATH_VEC3_CROSS, lane_error(&v.x, want, a_length * b_length));
+
+        v = vec3_normalize(va);
+        for (int i = 0; i < 3; i++) want[i] = a[i] / a_length;
+        math_record(errors, MATH_VEC3_NORMALIZE, lane_error(&v.x, want, 1.0));
+
+        double rsqrt = 1.0 / sqrt(fabs(k));
+        math_record(errors, MATH_FAST_RSQRT, fabs(fast_rsqrt(fabsf(k)) - rsqrt) / rsqrt);
+
+        // colors are mostly 0 to 1 but light can add up past that
+        Color ca = {fabsf(a[0]) * 1e-3f, fabsf(a[1]) * 1e-3f, fabsf(a[2]) * 1e-3f};
+        Color cb = {fabsf(b[0]) * 1e-3f, fabsf(b[1]) * 1e-3f, fabsf(b[2]) * 1e-3f};
+        float ca_lanes[3] = {ca.r, ca.g, ca.b};
+        float cb_lanes[3] = {cb.r, cb.g, cb.b};
+        double ca_length = length3(ca.r, ca.g, ca.b);
+        double cb_length = length3(cb.r, cb.g, cb.b);
+        Color c;
+
+        c = color_add(ca, cb);
+        for (int i = 0; i < 3; i++) want[i] = fmin(fmax((double) ca_lanes[i] + cb_lanes[i], 0.0), 1.0);
+        math_record(errors, MATH_COLOR_ADD, lane_error(&c.r, want, 1.0));
+
+        c = color_sum(ca, cb);
+        for (int i = 0; i < 3; i++) want[i] = (double) ca_lanes[i] + cb_lanes[i];
+        math_record(errors, MATH_COLOR_SUM, lane_error(&c.r, want, ca_length + cb_length));
+
+        c = color_mul(ca, cb);
+        for (int i = 0; i < 3; i++) want[i] = (double) ca_lanes[i] * cb_lanes[i];
+        math_record(errors, MATH_COLOR_MUL, lane_error(&c.r, want, ca_length * cb_length));
+
+        c = color_scale(ca, k);
+        for (int i = 0; i < 3; i++) want[i] = (double) ca_lanes[i] * k;
+        math_record(errors, MATH_COLOR_SCALE, lane_error(&c.r, want, ca_length * fabs(k)));
+
+        c = color_lerp(ca, cb, alpha);
+        for (int i = 0; i < 3; i++) want[i] = (1.0 - alpha) * ca_lanes[i] + (double) alpha * cb_lanes[i];
+        math_record(errors, MATH_COLOR_LERP, lane_error(&c.r, want, ca_length + cb_length));
+
+#ifdef RAYTRACE_SIMD
+        // the padding lane has to stay 0 or dot products pick it up
+        if (vec3_cross(va, vb).w != 0.0f || vec3_normalize(va).w != 0.0f ||
+            color_lerp(ca, cb, alpha).a != 0.0f || color_add(ca, cb).a != 0.0f) {
+            padding_ok = false;
+        }
+#endif
+    }
+
+#ifdef RAYTRACE_SIMD
+    printf("sse math, %d inputs\n\n", CHECK_MATH_INPUTS);
+#else
+    printf("plain math, %d inputs\n\n", CHECK_MATH_INPUTS);
+#endif
+    printf("function        max error      bound\n");
+
+    int failed = 0;
+    for (int op = 0; op < MATH_OP_COUNT; op++) {
+        bool ok = errors[op].max <= errors[op].bound;
+        if (!ok) failed++;
+        printf("%-14s %10.2e %10.2e %s\n", errors[op].name, errors[op].max, errors[op].bound, ok ? "" : "FAIL");
+    }
+
+    if (!padding_ok) {
+        printf("\nthe padding lane didn't stay 0\n");
+        failed++;
+    }
+
+    if (failed) printf("\n%d failed\n", failed);
+    return failed ? 1 : 0;
+}
+
+int main (int argc, char **argv) {
+    if (argc >= 2 && strcmp(argv[1], "math") == 0) return check_math();
+
+    const char *golden_dir = "golden";
+    const char *baseline = "check_baseline.txt";
+    double slowdown = CHECK_SLOWDOWN;
+    int level = 0;
+    bool update = false;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-g") == 0) golden_dir = argv[i + 1];
+        else if (strcmp(argv[i], "-b") == 0) baseline = argv[i + 1];
+        else if (strcmp(argv[i], "-p") == 0) slowdown = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "-f") == 0) level = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-u") == 0) update = atoi(argv[i + 1]) != 0;
+        else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    Render_State state = DEFAULT_RENDER_STATE;
+    setup_scene(&state);
+    state.fast_math = update ? 0 : level;
+
+    int width = CHECK_WIDTH;
+    int height = CHECK_HEIGHT;
+    int case_count = ARRAY_LEN(check_cases);
+    Color *colors = malloc(width * height * sizeof(Color));
+    double *rays = malloc(case_count * sizeof(double));
+
+    // the baseline only gets written when there's nothing to compare with
+    FILE *probe = fopen(baseline, "r");
+    bool save_baseline = update || !probe;
+    if (probe) fclose(probe);
+
+    printf("%d x %d, timed with %d x %d rays, fast_math %d\n\n", width, height, CHECK_TIME_WIDTH, CHECK_TIME_HEIGHT, state.fast_math);
+    printf("case        mean de   different   max de        Mrays/s   baseline   noise\n");
+
+    int failed = 0;
+    for (int i = 0; i < case_count; i++) {
+        Check_Case c = check_cases[i];
+        Render_State case_state = check_state(&state, c);
+        check_render(&case_state, c, colors, width, height);
+
+        int time_width = CHECK_TIME_WIDTH / c.samples;
+        int time_height = CHECK_TIME_HEIGHT / c.samples;
+        double noise;
+        double time = check_time(&case_state, c, time_width, time_height, &noise);
+        rays[i] = (double) time_width * time_height * c.samples * c.samples / time;
+
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s.hdr", golden_dir, c.name);
+
+        printf("%-10s", c.name);
+
+        Image_Difference d;
+        bool image_ok = true;
+
+        if (update) {
+            if (!write_golden(path, colors, width, height)) {
+                printf(" couldn't write %s\n", path);
+                failed++;
+                continue;
+            }
+            printf(" %-37s", "written");
+        } else {
+            int golden_width, golden_height;
+            Color *golden = read_hdr(path, &golden_width, &golden_height);
+            if (!golden || golden_width != width || golden_height != height) {
+                printf(" couldn't read %s as a %dx%d .hdr\n", path, width, height);
+                free(golden);
+                failed++;
+                continue;
+            }
+
+            d = image_difference(colors, golden, width, height, c.hdr);
+            free(golden);
+
+            image_ok = d.different <= CHECK_MAX_DIFFERENT && d.mean_de <= CHECK_MAX_MEAN_DE;
+            if (!image_ok) failed++;
+
+            printf(" %8.3f %10.2f%% %8.2f %-6s",
+                d.mean_de, d.different * 100.0, d.max_de, image_ok ? "" : "FAIL");
+        }
+
+        printf(" %9.3f", rays[i] / 1e6);
+
+        double before = save_baseline ? 0.0 : baseline_rays(baseline, c.name);
+        if (before > 0.0) {
+            double change = (rays[i] / before - 1.0) * 100.0;
+            bool speed_ok = change >= -(slowdown + noise * 100.0);
+            if (!speed_ok) failed++;
+            printf(" %+9.1f%% %6.1f%% %s", change, noise * 100.0, speed_ok ? "" : "SLOWER");
+        }
+        printf("\n");
+
+        if (!image_ok) printf("%10s the worst pixel is at %d, %d\n", "", d.max_x, d.max_y);
+    }
+
+    if (save_baseline) {
+        FILE *file = fopen(baseline, "w");
+        if (file) {
+            for (int i = 0; i < case_count; i++) fprintf(file, "%s %.0f\n", check_cases[i].name, rays[i]);
+            fclose(file);
+            printf("\nsaved the speeds to %s\n", baseline);
+        } else {
+            printf("\ncouldn't write %s\n", baseline);
+            failed++;
+        }
+    }
+
+    if (failed) printf("\n%d failed\n", failed);
+
+    free(colors);
+    free(rays);
+    return failed ? 1 : 0;
+}
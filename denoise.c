@@ -0,0 +1,387 @@
+// cleans up renders done with only a few samples per pixel. it's an edge
+// avoiding a-trous filter: a 5x5 blur done DENOISE_PASSES times with the taps
+// twice as far apart each time, so it reaches far without needing a huge
+// kernel. what stops it from blurring everything together is a second set of
+// images from where the pixel's rays first hit: the normal, how far away it
+// is and the material color there. taps that differ from the pixel in any of
+// those (or too much in the noisy light itself) count for less, so edges and
+// silhouettes stay sharp while shadows and the noise in flat areas get
+// smoothed out. how much the light can differ goes with how bright the pixel
+// is and gets much smaller with more samples per pixel, since there's less
+// noise to take out and blurring costs more than it gains. benchmark
+// samplers compares it with plain sobol at every sample count.
+//
+// what gets blurred is only the light, the colors divided by the material
+// color. the checkerboard gets put back on top afterwards from the guide
+// images, which have more rays per pixel, so it comes out smoother than it
+// was rendered instead of blurry.
+//
+// every image is kept as separate float planes with a border around them, so
+// four pixels next to each other are four floats next to each other and the
+// filter does four at a time with sse and no special cases at the edges.
+// the border has depth -1 which makes those taps count for nothing. the rows
+// get split between threads for each pass
+
+#include <emmintrin.h>
+
+#define DENOISE_PASSES 5
+
+// the guide images get this many times the rays per side the colors had
+#define DENOISE_FEATURE_SCALE 2
+
+// how different the light at a tap can be before it stops counting, as a
+// share of the pixel's own brightness, on the first pass with one sample per
+// pixel. it's divided by DENOISE_SIGMA_FALLOFF every pass after that and by
+// the samples per side cubed. these came from benchmark samplers, the first
+// pass does most of the work at one sample and anything more than this
+// blurs away detail at more samples
+#define DENOISE_COLOR_SIGMA 3.0f
+#define DENOISE_SIGMA_FALLOFF 8.0f
+
+// brightness below this counts as this much, so black pixels still blur
+#define DENOISE_MIN_BRIGHTNESS 0.05f
+
+// as far as a tap can reach on the last pass, 2 * (1 << (DENOISE_PASSES - 1))
+#define DENOISE_BORDER 32
+
+// as far as all the passes together reach, a pixel only depends on the
+// colors this close to it. 2 * ((1 << DENOISE_PASSES) - 1)
+#define DENOISE_REACH 62
+
+// keeps dark materials from blowing up when the colors get divided by them
+#define DENOISE_MIN_ALBEDO 0.01f
+
+// depth for pixels that don't hit anything
+#define DENOISE_SKY_DEPTH 1e6f
+
+enum {
+    DENOISE_R, DENOISE_G, DENOISE_B,
+    DENOISE_NORMAL_X, DENOISE_NORMAL_Y, DENOISE_NORMAL_Z,
+    DENOISE_DEPTH,
+    DENOISE_ALBEDO_R, DENOISE_ALBEDO_G, DENOISE_ALBEDO_B,
+    DENOISE_PLANES
+};
+
+typedef struct Denoiser {
+    const Render_State *state; // what the guide images get traced from
+    int x;                     // where the denoised window is in the frame
+    int y;
+    int width;
+    int height;
+    int frame_width;
+    int frame_height;
+    int stride; // border on both sides, plus 4 so the last group of four can read past the end
+
+    float *planes[DENOISE_PLANES];
+    float *filtered[3]; // the color planes of the pass being written
+
+    int samples;
+    int threads;
+    int step;           // how far apart the taps are this pass
+    float color_sigma;  // how different a tap's color can be before it stops counting, this pass, relative to the pixel's brightness
+} Denoiser;
+
+typedef struct Denoise_Band {
+    Denoiser *denoiser;
+    int y0;
+    int y1;
+} Denoise_Band;
+
+int denoise_index (Denoiser *d, int x, int y) {
+    return (y + DENOISE_BORDER) * d->stride + x + DENOISE_BORDER;
+}
+
+// runs proc on threads bands of rows and waits for all of them
+void denoise_run (Denoiser *d, Thread_Proc proc) {
+    Thread *pool = malloc(d->threads * sizeof(Thread));
+    Denoise_Band *bands = malloc(d->threads * sizeof(Denoise_Band));
+
+    for (int i = 0; i < d->threads; i++) {
+        bands[i] = (Denoise_Band) {
+            .denoiser = d,
+            .y0 = d->height * i / d->threads,
+            .y1 = d->height * (i + 1) / d->threads
+        };
+        pool[i] = thread_start(proc, &bands[i]);
+    }
+    for (int i = 0; i < d->threads; i++) thread_join(pool[i]);
+
+    free(pool);
+    free(bands);
+}
+
+// the material color of whatever a ray first hits, white if it misses so
+// the sky is left alone
+Color denoise_first_hit (const Render_State *state, Ray sight, Vector3 *normal, float *depth) {
+    float t;
+    int object;
+    if (intersect_scene(state, sight, 0.0f, INFINITY, &t, &object, normal)) {
+        *depth = t;
+        return object_material(state, state->scene[object], parametric_line(t, sight)).color;
+    }
+
+    *normal = (Vector3) {0.0f, 0.0f, -1.0f};
+    *depth = DENOISE_SKY_DEPTH;
+    return (Color) {1.0f, 1.0f, 1.0f};
+}
+
+// the guide images. they're traced with DENOISE_FEATURE_SCALE times the
+// rays per side the colors had, only the first hits are needed so it's
+// cheap, and then edges and the far away checkerboard come out
+// smooth in them. the colors get divided by the material color of the rays
+// they actually came from, which leaves only the light, and that gets
+// multiplied by the smooth material color at the end
+void denoise_features_thread (void *param) {
+    Denoise_Band *band = param;
+    Denoiser *d = band->denoiser;
+    const Render_State *state = d->state;
+    int samples = d->samples;
+    int feature_samples = samples * DENOISE_FEATURE_SCALE;
+    float sample_weight = 1.0f / (float) (samples * samples);
+    float feature_weight = 1.0f / (float) (feature_samples * feature_samples);
+
+    for (int y = band->y0; y < band->y1; y++) {
+        for (int x = 0; x < d->width; x++) {
+            Vector3 normal_sum = {0};
+            Color albedo_sum = {0};
+            float depth_sum = 0.0f;
+            Color sample_albedo = {0};
+
+            Vector3 normal;
+            float depth;
+
+            for (int sample = 0; sample < feature_samples * feature_samples; sample++) {
+                Ray sight = primary_ray(state, d->x + x, d->y + y, d->frame_width, d->frame_height, sample, feature_samples);
+                Color albedo = denoise_first_hit(state, sight, &normal, &depth);
+
+                normal_sum = vec3_add(normal_sum, normal);
+                albedo_sum = color_sum(albedo_sum, albedo);
+                depth_sum += depth;
+            }
+
+            for (int sample = 0; sample < samples * samples; sample++) {
+                Ray sight = primary_ray(state, d->x + x, d->y + y, d->frame_width, d->frame_height, sample, samples);
+                sample_albedo = color_sum(sample_albedo, denoise_first_hit(state, sight, &normal, &depth));
+            }
+
+            int i = denoise_index(d, x, y);
+            d->planes[DENOISE_R][i] /= fmaxf(sample_albedo.r * sample_weight, DENOISE_MIN_ALBEDO);
+            d->planes[DENOISE_G][i] /= fmaxf(sample_albedo.g * sample_weight, DENOISE_MIN_ALBEDO);
+            d->planes[DENOISE_B][i] /= fmaxf(sample_albedo.b * sample_weight, DENOISE_MIN_ALBEDO);
+
+            d->planes[DENOISE_NORMAL_X][i] = normal_sum.x * feature_weight;
+            d->planes[DENOISE_NORMAL_Y][i] = normal_sum.y * feature_weight;
+            d->planes[DENOISE_NORMAL_Z][i] = normal_sum.z * feature_weight;
+            d->planes[DENOISE_DEPTH][i] = depth_sum * feature_weight;
+            d->planes[DENOISE_ALBEDO_R][i] = albedo_sum.r * feature_weight;
+            d->planes[DENOISE_ALBEDO_G][i] = albedo_sum.g * feature_weight;
+            d->planes[DENOISE_ALBEDO_B][i] = albedo_sum.b * feature_weight;
+        }
+    }
+}
+
+// e^x for four x <= 0, same idea as fast_exp2
+FORCE_INLINE __m128 denoise_exp (__m128 x) {
+    // anything below 2^-64 might as well be 0, and stopping there keeps the
+    // weights away from denormals which are slow
+    x = _mm_max_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504f)), _mm_set1_ps(-64.0f));
+
+    // truncating rounds up for negative numbers, take one off where it did
+    __m128i whole = _mm_cvttps_epi32(x);
+    __m128 rounded_up = _mm_cmpgt_ps(_mm_cvtepi32_ps(whole), x);
+    whole = _mm_add_epi32(whole, _mm_castps_si128(rounded_up)); // true is -1
+    __m128 t = _mm_sub_ps(x, _mm_cvtepi32_ps(whole));
+
+    __m128 p = _mm_add_ps(_mm_set1_ps(0.22586994f), _mm_mul_ps(t, _mm_set1_ps(0.077822868f)));
+    p = _mm_add_ps(_mm_set1_ps(0.6961709f), _mm_mul_ps(t, p));
+    p = _mm_add_ps(_mm_set1_ps(0.9998639f), _mm_mul_ps(t, p));
+
+    __m128i bits = _mm_slli_epi32(_mm_add_epi32(whole, _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(bits));
+}
+
+FORCE_INLINE __m128 denoise_square (__m128 x) {
+    return _mm_mul_ps(x, x);
+}
+
+void denoise_filter_thread (void *param) {
+    Denoise_Band *band = param;
+    Denoiser *d = band->denoiser;
+
+    // the b3 spline, what the a-trous filter is usually done with
+    static const float kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 color_scale = _mm_set1_ps(1.0f / (d->color_sigma * d->color_sigma));
+    __m128 normal_scale = _mm_set1_ps(32.0f);
+    __m128 albedo_scale = _mm_set1_ps(1.0f / (0.1f * 0.1f));
+    __m128 sign_mask = _mm_set1_ps(-0.0f);
+
+    float **in = d->planes;
+    int step = d->step;
+
+    for (int y = band->y0; y < band->y1; y++) {
+        for (int x = 0; x < d->width; x += 4) {
+            int c = denoise_index(d, x, y);
+
+            __m128 center[DENOISE_PLANES];
+            for (int p = 0; p < DENOISE_PLANES; p++) center[p] = _mm_loadu_ps(&in[p][c]);
+
+            // the noise is bigger in bright pixels, so the colors are compared
+            // relative to how bright this one is
+            __m128 brightness = _mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(center[DENOISE_R], _mm_set1_ps(0.2126f)),
+                _mm_mul_ps(center[DENOISE_G], _mm_set1_ps(0.7152f))),
+                _mm_mul_ps(center[DENOISE_B], _mm_set1_ps(0.0722f)));
+            brightness = _mm_max_ps(brightness, _mm_set1_ps(DENOISE_MIN_BRIGHTNESS));
+            __m128 pixel_color_scale = _mm_div_ps(color_scale, _mm_mul_ps(brightness, brightness));
+
+            // depth differences are relative to how far away the pixel is
+            // and how far away the tap is, so slanted floors still blur
+            __m128 depth_scale = _mm_div_ps(_mm_set1_ps(20.0f), _mm_max_ps(center[DENOISE_DEPTH], _mm_set1_ps(1e-3f)));
+
+            __m128 total_weight = zero;
+            __m128 sum_r = zero;
+            __m128 sum_g = zero;
+            __m128 sum_b = zero;
+
+            for (int ty = -2; ty <= 2; ty++) {
+                for (int tx = -2; tx <= 2; tx++) {
+                    int q = c + (ty * d->stride + tx) * step;
+                    int tap_distance = (abs(tx) + abs(ty)) * step;
+
+                    __m128 r = _mm_loadu_ps(&in[DENOISE_R][q]);
+                    __m128 g = _mm_loadu_ps(&in[DENOISE_G][q]);
+                    __m128 b = _mm_loadu_ps(&in[DENOISE_B][q]);
+                    __m128 depth = _mm_loadu_ps(&in[DENOISE_DEPTH][q]);
+
+                    __m128 color_error = _mm_add_ps(_mm_add_ps(
+                        denoise_square(_mm_sub_ps(r, center[DENOISE_R])),
+                        denoise_square(_mm_sub_ps(g, center[DENOISE_G]))),
+                        denoise_square(_mm_sub_ps(b, center[DENOISE_B])));
+
+                    __m128 normal_dot = _mm_add_ps(_mm_add_ps(
+                        _mm_mul_ps(_mm_loadu_ps(&in[DENOISE_NORMAL_X][q]), center[DENOISE_NORMAL_X]),
+                        _mm_mul_ps(_mm_loadu_ps(&in[DENOISE_NORMAL_Y][q]), center[DENOISE_NORMAL_Y])),
+                        _mm_mul_ps(_mm_loadu_ps(&in[DENOISE_NORMAL_Z][q]), center[DENOISE_NORMAL_Z]));
+
+                    __m128 depth_error = _mm_andnot_ps(sign_mask, _mm_sub_ps(depth, center[DENOISE_DEPTH]));
+
+                    __m128 albedo_error = _mm_add_ps(_mm_add_ps(
+                        denoise_square(_mm_sub_ps(_mm_loadu_ps(&in[DENOISE_ALBEDO_R][q]), center[DENOISE_ALBEDO_R])),
+                        denoise_square(_mm_sub_ps(_mm_loadu_ps(&in[DENOISE_ALBEDO_G][q]), center[DENOISE_ALBEDO_G]))),
+                        denoise_square(_mm_sub_ps(_mm_loadu_ps(&in[DENOISE_ALBEDO_B][q]), center[DENOISE_ALBEDO_B])));
+
+                    __m128 error = _mm_mul_ps(color_error, pixel_color_scale);
+                    error = _mm_add_ps(error, _mm_mul_ps(_mm_max_ps(_mm_sub_ps(one, normal_dot), zero), normal_scale));
+                    error = _mm_add_ps(error, _mm_mul_ps(_mm_mul_ps(depth_error, depth_scale), _mm_set1_ps(1.0f / (float) (tap_distance + 1))));
+                    error = _mm_add_ps(error, _mm_mul_ps(albedo_error, albedo_scale));
+
+                    __m128 weight = _mm_mul_ps(_mm_set1_ps(kernel[ty + 2] * kernel[tx + 2]), denoise_exp(_mm_sub_ps(zero, error)));
+                    weight = _mm_and_ps(weight, _mm_cmpge_ps(depth, zero)); // the border
+
+                    total_weight = _mm_add_ps(total_weight, weight);
+                    sum_r = _mm_add_ps(sum_r, _mm_mul_ps(weight, r));
+                    sum_g = _mm_add_ps(sum_g, _mm_mul_ps(weight, g));
+                    sum_b = _mm_add_ps(sum_b, _mm_mul_ps(weight, b));
+                }
+            }
+
+            // the pixel itself always counts so this is never 0 inside the
+            // image, past the right edge it can be so those lanes don't get
+            // stored
+            __m128 out[3] = {
+                _mm_div_ps(sum_r, total_weight),
+                _mm_div_ps(sum_g, total_weight),
+                _mm_div_ps(sum_b, total_weight),
+            };
+
+            for (int p = 0; p < 3; p++) {
+                if (x + 4 <= d->width) {
+                    _mm_storeu_ps(&d->filtered[p][c], out[p]);
+                } else {
+                    ALIGN16 float last[4];
+                    _mm_store_ps(last, out[p]);
+                    for (int lane = 0; x + lane < d->width; lane++) d->filtered[p][c + lane] = last[lane];
+                }
+            }
+        }
+    }
+}
+
+// denoises the width x height window at x0, y0 of a frame_width x
+// frame_height frame that was rendered from state with samples samples per
+// side. colors is only the window and it's done in place, using threads
+// threads. the guide images are traced from state too. the window's edges
+// are treated like the frame's, so anything that should blur in from
+// around it has to be in the window
+void denoise_window (
+    const Render_State *state, Color *colors, int x0, int y0, int width, int height,
+    int frame_width, int frame_height, int samples, int threads
+) {
+    Denoiser d = {0};
+    d.state = state;
+    d.x = x0;
+    d.y = y0;
+    d.width = width;
+    d.height = height;
+    d.frame_width = frame_width;
+    d.frame_height = frame_height;
+    d.samples = samples;
+    d.stride = width + 2 * DENOISE_BORDER + 4;
+    d.threads = threads < 1 ? 1 : threads;
+    if (d.threads > height) d.threads = height;
+
+    size_t plane_size = (size_t) d.stride * (height + 2 * DENOISE_BORDER);
+    for (int p = 0; p < DENOISE_PLANES; p++) d.planes[p] = calloc(plane_size, sizeof(float));
+    for (int p = 0; p < 3; p++) d.filtered[p] = calloc(plane_size, sizeof(float));
+
+    for (size_t i = 0; i < plane_size; i++) d.planes[DENOISE_DEPTH][i] = -1.0f;
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int i = denoise_index(&d, x, y);
+            Color color = colors[y * width + x];
+            d.planes[DENOISE_R][i] = color.r;
+            d.planes[DENOISE_G][i] = color.g;
+            d.planes[DENOISE_B][i] = color.b;
+        }
+    }
+
+    denoise_run(&d, denoise_features_thread);
+
+    for (int pass = 0; pass < DENOISE_PASSES; pass++) {
+        d.step = 1 << pass;
+
+        // the noise gets smaller every pass so the colors have to be closer
+        // to count
+        float sample_scale = (float) samples * samples * samples;
+        d.color_sigma = DENOISE_COLOR_SIGMA / (powf(DENOISE_SIGMA_FALLOFF, (float) pass) * sample_scale);
+        denoise_run(&d, denoise_filter_thread);
+
+        for (int p = 0; p < 3; p++) {
+            float *swap = d.planes[DENOISE_R + p];
+            d.planes[DENOISE_R + p] = d.filtered[p];
+            d.filtered[p] = swap;
+        }
+    }
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int i = denoise_index(&d, x, y);
+            Color *color = &colors[y * width + x];
+            color->r = d.planes[DENOISE_R][i] * fmaxf(d.planes[DENOISE_ALBEDO_R][i], DENOISE_MIN_ALBEDO);
+            color->g = d.planes[DENOISE_G][i] * fmaxf(d.planes[DENOISE_ALBEDO_G][i], DENOISE_MIN_ALBEDO);
+            color->b = d.planes[DENOISE_B][i] * fmaxf(d.planes[DENOISE_ALBEDO_B][i], DENOISE_MIN_ALBEDO);
+        }
+    }
+
+    for (int p = 0; p < DENOISE_PLANES; p++) free(d.planes[p]);
+    for (int p = 0; p < 3; p++) free(d.filtered[p]);
+}
+
+// denoises a whole width x height frame of colors, see denoise_window
+void denoise_frame (const Render_State *state, Color *colors, int width, int height, int samples, int threads) {
+    denoise_window(state, colors, 0, 0, width, height, width, height, samples, threads);
+}
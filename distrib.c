@@ -0,0 +1,484 @@
+// distributed rendering. a coordinator process owns the image and hands out
+// tiles to worker processes, which can be on this machine or on other ones.
+//
+//     distrib coordinator [-l address] [-j local_workers] [-k tiles]
+//                         [-o out.ppm] [-w width] [-h height] [-s samples]
+//                         [-f fast_math] [-t tile_size] [-r frames]
+//                         [-a light_size]
+//     distrib worker address
+//
+// address is "unix:/path" or "host:port" (see net.c), the coordinator
+// listens on it (default unix:/tmp/raytrace.sock). -j starts that many
+// workers on this machine, and workers anywhere else can join with
+// "distrib worker coordinator-host:port" at any time.
+//
+// every worker gets the scene blob once when it connects and is then given
+// one tile at a time, so fast workers just end up doing more tiles. if a
+// worker goes away its tile goes back on the list for someone else. -k makes
+// the first local worker quit without a word after that many tiles, which is
+// for trying out the recovery.
+//
+// a worker can also hang without going away. once there's nothing left to
+// hand out, a tile that's taken DISTRIB_DEADLINE_SCALE times longer than
+// schedule.c guessed is given to an idle worker as well and whichever copy
+// comes back first is used. idle workers would only be waiting for the last
+// tiles otherwise, so the extra copies don't cost anything.
+//
+// -r renders the image that many times over with the same workers, which
+// is what an animation or progressive passes would look like. the first
+// frame hands out a plain grid of tiles, after that the tiles are planned
+// from how long each part of the image took last time (see schedule.c).
+
+#include <poll.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "render.c"
+#include "output.c"
+#include "net.c"
+
+enum {
+    DISTRIB_SCENE = 1, // scene blob, coordinator -> worker
+    DISTRIB_JOB,       // Distrib_Job, coordinator -> worker
+    DISTRIB_TILE,      // Distrib_Tile, coordinator -> worker
+    DISTRIB_RESULT,    // Distrib_Tile then the pixels, worker -> coordinator
+    DISTRIB_DONE       // nothing, coordinator -> worker
+};
+
+typedef struct Distrib_Job {
+    s32 width;
+    s32 height;
+    s32 samples;
+    s32 fast_math;
+} Distrib_Job;
+
+typedef struct Distrib_Tile {
+    s32 index;
+    s32 x;
+    s32 y;
+    s32 width;
+    s32 height;
+    float seconds; // how long the worker took, filled in by the worker
+} Distrib_Tile;
+
+#define DISTRIB_MAX_WORKERS 256
+
+// how long the coordinator waits with no workers at all before giving up
+#define DISTRIB_NO_WORKER_TIMEOUT 30.0
+
+// a tile is late once it's taken this many times longer than schedule.c
+// guessed, and never sooner than DISTRIB_MIN_DEADLINE seconds. before the
+// first frame is done there's no guess so it's just the minimum
+#define DISTRIB_DEADLINE_SCALE 4.0
+#define DISTRIB_MIN_DEADLINE 5.0
+
+// a worker that stops halfway through a message gets dropped after this
+// instead of holding up everyone else
+#define DISTRIB_RECV_TIMEOUT_MS 1000
+
+#include "schedule.c"
+
+double distrib_seconds () {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+// worker
+
+int run_worker (const char *address, int die_after) {
+    // the coordinator might still be starting up
+    int fd = -1;
+    for (int attempt = 0; attempt < 50 && fd < 0; attempt++) {
+        fd = net_connect(address);
+        if (fd < 0) usleep(100 * 1000);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "worker: couldn't connect to %s\n", address);
+        return 1;
+    }
+
+    Render_State state = DEFAULT_RENDER_STATE;
+    Net_Header header;
+    u8 *data = NULL;
+    u32 capacity = 0;
+
+    if (!net_recv_message(fd, &header, &data, &capacity, scene_blob_size()) ||
+        header.type != DISTRIB_SCENE || !scene_unpack(&state, data, header.size)) {
+        fprintf(stderr, "worker: bad scene from %s\n", address);
+        return 1;
+    }
+
+    Distrib_Job job;
+    if (!net_recv_message(fd, &header, &data, &capacity, sizeof(job)) ||
+        header.type != DISTRIB_JOB || header.size != sizeof(job)) {
+        fprintf(stderr, "worker: bad job from %s\n", address);
+        return 1;
+    }
+    memcpy(&job, data, sizeof(job));
+    state.fast_math = job.fast_math;
+
+    Color *colors = NULL;
+    u8 *result = NULL;
+    int tiles_done = 0;
+
+    while (net_recv_message(fd, &header, &data, &capacity, sizeof(Distrib_Tile))) {
+        if (header.type == DISTRIB_DONE) break;
+        if (header.type != DISTRIB_TILE || header.size != sizeof(Distrib_Tile)) continue;
+
+        if (die_after > 0 && tiles_done == die_after) {
+            fprintf(stderr, "worker %d: quitting on purpose after %d tiles\n", getpid(), tiles_done);
+            _exit(1);
+        }
+
+        Distrib_Tile tile;
+        memcpy(&tile, data, sizeof(tile));
+
+        int pixel_count = tile.width * tile.height;
+        colors = realloc(colors, pixel_count * sizeof(Color));
+        result = realloc(result, sizeof(tile) + pixel_count * sizeof(u32));
+
+        double start = distrib_seconds();
+        trace_block(&state, colors, tile.x, tile.y, tile.width, tile.height, job.width, job.height, job.samples);
+        tile.seconds = (float) (distrib_seconds() - start);
+
+        memcpy(result, &tile, sizeof(tile));
+        u32 *pixels = (u32 *) (result + sizeof(tile));
+        for (int i = 0; i < pixel_count; i++) pixels[i] = color_to_pixel(colors[i]);
+
+        if (!net_send_message(fd, DISTRIB_RESULT, result, sizeof(tile) + pixel_count * sizeof(u32))) break;
+        tiles_done++;
+    }
+
+    free(colors);
+    free(result);
+    free(data);
+    close(fd);
+    return 0;
+}
+
+// coordinator
+
+typedef enum Tile_State {
+    TILE_TODO,
+    TILE_ASSIGNED,
+    TILE_DONE
+} Tile_State;
+
+typedef struct Distrib_Worker {
+    int fd;
+    int tile;  // tile it's working on, -1 if it's idle
+    int frame; // frame that tile is from, a late one can still be busy after its frame is done
+    int tiles_done;
+} Distrib_Worker;
+
+// forgets a worker. whatever it was doing has to be done again, unless
+// it's done already or someone else is still on it
+void drop_worker (Distrib_Worker *workers, int *worker_count, int w, Tile_State *states, int frame, int *reissued) {
+    int t = workers[w].tile;
+    bool requeue = t >= 0 && workers[w].frame == frame && states[t] == TILE_ASSIGNED;
+    for (int i = 0; i < *worker_count && requeue; i++) {
+        if (i != w && workers[i].tile == t && workers[i].frame == frame) requeue = false;
+    }
+    if (requeue) {
+        states[t] = TILE_TODO;
+        (*reissued)++;
+    }
+
+    fprintf(stderr, "coordinator: lost a worker after %d tiles\n", workers[w].tiles_done);
+    close(workers[w].fd);
+    workers[w] = workers[--(*worker_count)];
+}
+
+int run_coordinator (
+    const char *address, int local_workers, int die_after,
+    const char *output, Distrib_Job job, int tile_size, int frames, float light_size
+) {
+    int listen_fd = net_listen(address);
+    if (listen_fd < 0) {
+        fprintf(stderr, "coordinator: couldn't listen on %s\n", address);
+        return 1;
+    }
+
+    Render_State state = DEFAULT_RENDER_STATE;
+    state.light_size = light_size;
+    setup_scene(&state);
+
+    u32 blob_size = scene_blob_size();
+    u8 *blob = malloc(blob_size);
+    scene_pack(&state, blob);
+
+    Sched_Costs costs;
+    sched_init(&costs, job.width, job.height);
+
+    Distrib_Tile *tiles = NULL;
+    Tile_State *states = NULL;
+    double *deadlines = NULL; // when each assigned tile is late
+    int tile_count = 0;
+
+    u32 *image = calloc((size_t) job.width * job.height, sizeof(u32));
+
+    pid_t children[DISTRIB_MAX_WORKERS];
+    int child_count = 0;
+
+    for (int i = 0; i < local_workers && i < DISTRIB_MAX_WORKERS; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(listen_fd);
+            _exit(run_worker(address, i == 0 ? die_after : 0));
+        }
+        if (pid > 0) children[child_count++] = pid;
+    }
+
+    Distrib_Worker workers[DISTRIB_MAX_WORKERS];
+    int worker_count = 0;
+    int reissued = 0;
+    int done_count = 0;
+
+    // a result is a tile of the image, it can't be bigger than all of it
+    u32 max_result = sizeof(Distrib_Tile) + (size_t) job.width * job.height * sizeof(u32);
+
+    Net_Header header;
+    u8 *data = NULL;
+    u32 capacity = 0;
+
+    double start = distrib_seconds();
+    double last_worker_seen = start;
+
+    // every frame is the same image, the later ones get their tiles from
+    // how long the earlier ones took (see schedule.c)
+    for (int frame = 0; frame < frames; frame++) {
+        // nobody's connected yet on the first frame so guess at the local ones
+        int expected_workers = worker_count > 0 ? worker_count : local_workers;
+        tile_count = sched_plan(&costs, tile_size, expected_workers, &tiles);
+        states = realloc(states, tile_count * sizeof(Tile_State));
+        deadlines = realloc(deadlines, tile_count * sizeof(double));
+        for (int i = 0; i < tile_count; i++) states[i] = TILE_TODO;
+
+        done_count = 0;
+        int next_tile = 0;
+
+        double frame_start = distrib_seconds();
+        double tail_start = 0.0; // when the first worker had nothing left to take
+
+        while (done_count < tile_count) {
+            // give out tiles to everyone who doesn't have one. this is before the
+            // poll so a new frame gets going without waiting for it to time out
+            for (int w = worker_count - 1; w >= 0; w--) {
+                if (workers[w].tile >= 0) continue;
+
+                // tiles that came back from a lost worker are in front of
+                // next_tile, so look from the start once we run out
+                int t = -1;
+                for (; next_tile < tile_count; next_tile++) {
+                    if (states[next_tile] == TILE_TODO) { t = next_tile++; break; }
+                }
+                if (t < 0) {
+                    for (int i = 0; i < tile_count; i++) {
+                        if (states[i] == TILE_TODO) { t = i; break; }
+                    }
+                }
+                if (t < 0 && tail_start == 0.0) tail_start = distrib_seconds();
+
+                // nothing new to do, so help out with a late one
+                double now = distrib_seconds();
+                bool late = false;
+                for (int i = 0; i < tile_count && t < 0; i++) {
+                    if (states[i] == TILE_ASSIGNED && now > deadlines[i]) { t = i; late = true; }
+                }
+                if (t < 0) break;
+
+                if (net_send_message(workers[w].fd, DISTRIB_TILE, &tiles[t], sizeof(Distrib_Tile))) {
+                    // a late tile gets a new deadline too so it doesn't go to
+                    // every idle worker at once
+                    double guess = DISTRIB_DEADLINE_SCALE * sched_guess(&costs, tiles[t]);
+                    deadlines[t] = now + (guess > DISTRIB_MIN_DEADLINE ? guess : DISTRIB_MIN_DEADLINE);
+                    states[t] = TILE_ASSIGNED;
+                    workers[w].tile = t;
+                    workers[w].frame = frame;
+                    if (late) reissued++;
+                } else {
+                    drop_worker(workers, &worker_count, w, states, frame, &reissued);
+                }
+            }
+
+            struct pollfd fds[DISTRIB_MAX_WORKERS + 1];
+            fds[0] = (struct pollfd) { .fd = listen_fd, .events = POLLIN };
+            for (int w = 0; w < worker_count; w++) {
+                fds[w + 1] = (struct pollfd) { .fd = workers[w].fd, .events = POLLIN };
+            }
+
+            if (poll(fds, worker_count + 1, 1000) < 0 && errno != EINTR) break;
+
+            // a worker going away moves the last one into its slot, so go
+            // backwards to not skip anyone
+            for (int w = worker_count - 1; w >= 0; w--) {
+                if (!(fds[w + 1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+                Distrib_Worker *worker = &workers[w];
+                Distrib_Tile reply;
+                Distrib_Tile tile;
+
+                // a late tile from a frame that's already done, someone else
+                // did it and the plan has changed since, so just let it go
+                if (worker->tile >= 0 && worker->frame != frame) {
+                    if (!net_recv_message(worker->fd, &header, &data, &capacity, max_result) || header.type != DISTRIB_RESULT) {
+                        drop_worker(workers, &worker_count, w, states, frame, &reissued);
+                    } else {
+                        worker->tile = -1;
+                    }
+                    continue;
+                }
+
+                // only the time comes from the worker, where the pixels go
+                // comes from our own tile. one that sends back a different
+                // tile (or nothing we asked for) gets dropped
+                bool ok = net_recv_message(worker->fd, &header, &data, &capacity, max_result) &&
+                    header.type == DISTRIB_RESULT && header.size >= sizeof(reply) && worker->tile >= 0;
+                if (ok) {
+                    memcpy(&reply, data, sizeof(reply));
+                    tile = tiles[worker->tile];
+                    ok = reply.index == tile.index && reply.x == tile.x && reply.y == tile.y &&
+                        reply.width == tile.width && reply.height == tile.height &&
+                        header.size == sizeof(tile) + (size_t) tile.width * tile.height * sizeof(u32);
+                }
+                if (ok) {
+                    tile.seconds = isfinite(reply.seconds) && reply.seconds >= 0.0f ? reply.seconds : 0.0f;
+                }
+
+                if (!ok) {
+                    drop_worker(workers, &worker_count, w, states, frame, &reissued);
+                    continue;
+                }
+
+                // a late tile was given to someone else too, first one back wins
+                if (states[tile.index] != TILE_DONE) {
+                    u32 *pixels = (u32 *) (data + sizeof(tile));
+                    for (int y = 0; y < tile.height; y++) {
+                        memcpy(
+                            &image[(tile.y + y) * job.width + tile.x],
+                            &pixels[y * tile.width],
+                            tile.width * sizeof(u32)
+                        );
+                    }
+                    states[tile.index] = TILE_DONE;
+                    done_count++;
+                    sched_record(&costs, tile, tile.seconds);
+                }
+
+                worker->tile = -1;
+                worker->tiles_done++;
+            }
+
+            if (fds[0].revents & POLLIN && worker_count < DISTRIB_MAX_WORKERS) {
+                int fd = net_accept(listen_fd);
+                if (fd >= 0) {
+                    net_set_recv_timeout(fd, DISTRIB_RECV_TIMEOUT_MS);
+                    if (net_send_message(fd, DISTRIB_SCENE, blob, blob_size) &&
+                        net_send_message(fd, DISTRIB_JOB, &job, sizeof(job))) {
+                        workers[worker_count++] = (Distrib_Worker) { .fd = fd, .tile = -1 };
+                    } else {
+                        close(fd);
+                    }
+                }
+            }
+
+            double now = distrib_seconds();
+            if (worker_count > 0) last_worker_seen = now;
+            if (now - last_worker_seen > DISTRIB_NO_WORKER_TIMEOUT) {
+                fprintf(stderr, "coordinator: no workers for %.0f seconds, giving up\n", DISTRIB_NO_WORKER_TIMEOUT);
+                break;
+            }
+        }
+
+        if (done_count < tile_count) break;
+
+        // the tail is the time some workers spent waiting for the last tiles
+        double frame_end = distrib_seconds();
+        if (tail_start == 0.0) tail_start = frame_end;
+        printf("frame %d: %d tiles in %.3fs, tail %.3fs\n",
+            frame, tile_count, frame_end - frame_start, frame_end - tail_start);
+
+        sched_end_frame(&costs);
+    }
+
+    double elapsed = distrib_seconds() - start;
+
+    for (int w = 0; w < worker_count; w++) {
+        printf("worker %d: %d tiles\n", w, workers[w].tiles_done);
+        net_send_message(workers[w].fd, DISTRIB_DONE, NULL, 0);
+        close(workers[w].fd);
+    }
+    close(listen_fd);
+    if (net_is_unix(address)) unlink(address + 5);
+
+    for (int i = 0; i < child_count; i++) waitpid(children[i], NULL, 0);
+
+    int result = 0;
+    if (done_count == tile_count) {
+        printf("%d frames in %.2fs, %d tiles given out again\n", frames, elapsed, reissued);
+        if (!write_ppm(output, image, job.width, job.height)) {
+            fprintf(stderr, "couldn't write %s\n", output);
+            result = 1;
+        }
+    } else {
+        fprintf(stderr, "coordinator: only finished %d of %d tiles\n", done_count, tile_count);
+        result = 1;
+    }
+
+    sched_free(&costs);
+    free(blob);
+    free(tiles);
+    free(states);
+    free(deadlines);
+    free(image);
+    free(data);
+    return result;
+}
+
+int main (int argc, char **argv) {
+    signal(SIGPIPE, SIG_IGN);
+
+    if (argc >= 3 && strcmp(argv[1], "worker") == 0) {
+        return run_worker(argv[2], 0);
+    }
+
+    if (argc < 2 || strcmp(argv[1], "coordinator") != 0) {
+        fprintf(stderr, "usage: distrib coordinator [options] | distrib worker address\n");
+        return 1;
+    }
+
+    const char *address = "unix:/tmp/raytrace.sock";
+    const char *output = "raytrace.ppm";
+    int local_workers = 0;
+    int die_after = 0;
+    int tile_size = 32;
+    int frames = 1;
+    float light_size = 0.0f;
+    Distrib_Job job = { .width = 1280, .height = 720, .samples = 1, .fast_math = 0 };
+
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if      (strcmp(argv[i], "-l") == 0) address = argv[i + 1];
+        else if (strcmp(argv[i], "-j") == 0) local_workers = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-k") == 0) die_after = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-o") == 0) output = argv[i + 1];
+        else if (strcmp(argv[i], "-w") == 0) job.width = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-h") == 0) job.height = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-s") == 0) job.samples = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-f") == 0) job.fast_math = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-t") == 0) tile_size = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-r") == 0) frames = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-a") == 0) light_size = (float) atof(argv[i + 1]);
+        else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (job.width <= 0 || job.height <= 0 || job.samples <= 0 || tile_size <= 0 || frames <= 0) {
+        fprintf(stderr, "width, height, samples, tile size and frames have to be positive\n");
+        return 1;
+    }
+
+    return run_coordinator(address, local_workers, die_after, output, job, tile_size, frames, light_size);
+}
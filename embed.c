@@ -0,0 +1,128 @@
+// shows how to use the tracer as a library (see raytrace.h). it only
+// includes the header and links with libraytrace.a like another program
+// would. two contexts render at the same time on two threads: the first one
+// renders the scene as it is and writes it out, the second one looks from
+// somewhere else with soft shadows and gets cancelled from its tile callback
+// once it's half done
+//
+//     embed [-o out.ppm] [-w width] [-h height] [-s samples]
+//
+// out.ppm comes out the same as headless with the same settings
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "raytrace.h"
+
+typedef struct Embed_Render {
+    Raytrace_Context *context;
+    Raytrace_Settings settings;
+    float *rgb;
+    const char *name;
+    int cancel_at; // tiles, 0 is never
+    Raytrace_Result result;
+} Embed_Render;
+
+void on_tile (void *user, int x, int y, int width, int height, int tiles_done, int tile_count) {
+    Embed_Render *render = user;
+    (void) x; (void) y; (void) width; (void) height;
+
+    if (tiles_done % 64 == 0 || tiles_done == tile_count) {
+        fprintf(stderr, "%s: %d of %d tiles\n", render->name, tiles_done, tile_count);
+    }
+    if (render->cancel_at && tiles_done >= render->cancel_at) raytrace_cancel(render->context);
+}
+
+#ifdef _WIN32
+DWORD WINAPI render_thread (LPVOID param) {
+#else
+void *render_thread (void *param) {
+#endif
+    Embed_Render *render = param;
+    render->result = raytrace_render(render->context, &render->settings, NULL, render->rgb, on_tile, render);
+    return 0;
+}
+
+// clamped and truncated, like the default tone mapping
+int write_ppm (const char *path, const float *rgb, int width, int height) {
+    FILE *file = fopen(path, "wb");
+    if (!file) return 0;
+
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    for (int i = 0; i < width * height * 3; i++) {
+        float v = rgb[i] < 0.0f ? 0.0f : rgb[i] > 1.0f ? 1.0f : rgb[i];
+        fputc((unsigned char) (v * 255.0f), file);
+    }
+    return fclose(file) == 0;
+}
+
+int main (int argc, char **argv) {
+    const char *output = "embed.ppm";
+    int width = 1280;
+    int height = 720;
+    int samples = 1;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if      (strcmp(argv[i], "-o") == 0) output = argv[i + 1];
+        else if (strcmp(argv[i], "-w") == 0) width = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-h") == 0) height = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-s") == 0) samples = atoi(argv[i + 1]);
+        else {
+            fprintf(stderr, "unknown option %s %s\n", argv[i], argv[i + 1]);
+            return 1;
+        }
+    }
+
+    Embed_Render renders[2] = {0};
+
+    for (int i = 0; i < 2; i++) {
+        renders[i].context = raytrace_create();
+        renders[i].settings = raytrace_default_settings(width, height);
+        renders[i].settings.samples = samples;
+        renders[i].settings.threads = 1;
+        renders[i].rgb = calloc((size_t) width * height * 3, sizeof(float));
+    }
+
+    renders[0].name = "front";
+
+    float pos[3] = {-6.0f, 4.0f, 2.0f};
+    float forward[3] = {0.25f, -0.15f, 1.0f};
+    float left[3] = {1.0f, 0.0f, -0.25f};
+    float up[3] = {0.0f, 1.0f, 0.15f};
+    raytrace_default_scene(renders[1].context, 4.0f);
+    raytrace_set_camera(renders[1].context, pos, forward, left, up, 1.4f);
+    renders[1].settings.sampler = RAYTRACE_SAMPLER_SOBOL;
+    renders[1].name = "side";
+    int tiles = ((width + 31) / 32) * ((height + 31) / 32);
+    renders[1].cancel_at = tiles / 2;
+
+#ifdef _WIN32
+    HANDLE threads[2];
+    for (int i = 0; i < 2; i++) threads[i] = CreateThread(0, 0, render_thread, &renders[i], 0, 0);
+    WaitForMultipleObjects(2, threads, TRUE, INFINITE);
+    for (int i = 0; i < 2; i++) CloseHandle(threads[i]);
+#else
+    pthread_t threads[2];
+    for (int i = 0; i < 2; i++) pthread_create(&threads[i], NULL, render_thread, &renders[i]);
+    for (int i = 0; i < 2; i++) pthread_join(threads[i], NULL);
+#endif
+
+    static const char *results[] = { "done", "cancelled", "bad settings" };
+    for (int i = 0; i < 2; i++) fprintf(stderr, "%s: %s\n", renders[i].name, results[renders[i].result]);
+
+    int ok = renders[0].result == RAYTRACE_OK && write_ppm(output, renders[0].rgb, width, height);
+    if (!ok) fprintf(stderr, "couldn't write %s\n", output);
+
+    for (int i = 0; i < 2; i++) {
+        raytrace_destroy(renders[i].context);
+        free(renders[i].rgb);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,607 @@
+// writes an image out while it's still being rendered. rows get handed in as
+// they're traced, every ENCODER_STRIP_ROWS of them make a strip, and the
+// strips get tone mapped and encoded by a few threads at once. they're
+// written to the file in order as soon as the one that's next is done, so
+// only the strips that are in flight are ever in memory and the encoding
+// happens while the rest of the image is still being traced.
+//
+// ppm and hdr strips are just their rows. for png every strip is its own
+// run of deflate blocks that ends on a byte boundary (like zlib's
+// Z_SYNC_FLUSH), so they can be compressed separately and then put one after
+// the other in the zlib stream. the deflate here only uses the fixed huffman
+// codes, which is a lot less code than building trees and still does well
+// on the filtered rows
+
+#define ENCODER_STRIP_ROWS 16
+
+typedef enum Image_Format {
+    IMAGE_PPM,
+    IMAGE_PNG,
+    IMAGE_HDR
+} Image_Format;
+
+typedef struct Encoder_Strip {
+    int index;
+    int y;
+    int rows;
+
+    // rows + 1 rows of colors, the first one is the row above the strip
+    // which png filters need (zeros for the first strip)
+    Color *colors;
+    int capacity;
+
+    u8 *data; // what goes in the file
+    size_t size;
+    size_t data_capacity;
+
+    u32 adler;       // png, of the uncompressed bytes in this strip
+    size_t raw_size;
+
+    bool ready; // encoded and waiting to be written
+} Encoder_Strip;
+
+typedef struct Image_Encoder {
+    FILE *file;
+    Image_Format format;
+    int width;
+    int height;
+    Tonemap tonemap;
+    int strip_count;
+
+    Thread *threads;
+    int thread_count;
+
+    Mutex lock;
+    Condition changed;
+
+    // strips go round in these slots, strip i is in slot i % slot_count
+    Encoder_Strip *slots;
+    int slot_count;
+
+    int rows_in;      // rows handed in so far
+    int strips_full;  // strips that have all their rows
+    int next_encode;  // next strip a thread should pick up
+    int next_write;   // next strip that goes in the file
+    bool writing;     // a thread is writing to the file right now
+    bool closing;
+    bool failed;
+
+    u32 adler; // png, of everything written so far
+} Image_Encoder;
+
+// crc32 for png chunks
+
+u32 crc_table[256];
+
+void crc_init () {
+    for (u32 n = 0; n < 256; n++) {
+        u32 c = n;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+}
+
+u32 crc_update (u32 crc, const u8 *data, size_t size) {
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) crc = crc_table[(crc ^ data[i]) & 255] ^ (crc >> 8);
+    return ~crc;
+}
+
+// adler32 for the end of the zlib stream
+
+#define ADLER_BASE 65521
+
+u32 adler_update (u32 adler, const u8 *data, size_t size) {
+    u32 a = adler & 0xFFFF;
+    u32 b = adler >> 16;
+
+    // 5552 is the most bytes before b can overflow
+    while (size > 0) {
+        size_t n = size < 5552 ? size : 5552;
+        size -= n;
+        for (size_t i = 0; i < n; i++) {
+            a += *data++;
+            b += a;
+        }
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+    }
+
+    return (b << 16) | a;
+}
+
+// adler of one block of data followed by another, from the adlers of both
+u32 adler_combine (u32 adler_1, u32 adler_2, size_t size_2) {
+    u64 a_1 = adler_1 & 0xFFFF, b_1 = adler_1 >> 16;
+    u64 a_2 = adler_2 & 0xFFFF, b_2 = adler_2 >> 16;
+    u64 rem = size_2 % ADLER_BASE;
+
+    u64 a = (a_1 + a_2 + ADLER_BASE - 1) % ADLER_BASE;
+    u64 b = (b_1 + b_2 + rem * (a_1 + ADLER_BASE - 1)) % ADLER_BASE;
+    return (u32) ((b << 16) | a);
+}
+
+// growing byte buffer that's written least significant bit first like
+// deflate wants
+
+typedef struct Bit_Writer {
+    u8 *data;
+    size_t size;
+    size_t capacity;
+    u64 bits;
+    int bit_count;
+} Bit_Writer;
+
+void bits_reserve (Bit_Writer *w, size_t extra) {
+    if (w->size + extra <= w->capacity) return;
+    while (w->size + extra > w->capacity) w->capacity = w->capacity ? w->capacity * 2 : 4096;
+    w->data = realloc(w->data, w->capacity);
+}
+
+void bits_put (Bit_Writer *w, u32 value, int count) {
+    w->bits |= (u64) value << w->bit_count;
+    w->bit_count += count;
+
+    bits_reserve(w, 8);
+    while (w->bit_count >= 8) {
+        w->data[w->size++] = (u8) w->bits;
+        w->bits >>= 8;
+        w->bit_count -= 8;
+    }
+}
+
+void bits_align (Bit_Writer *w) {
+    if (w->bit_count > 0) bits_put(w, 0, 8 - w->bit_count);
+}
+
+// huffman codes go most significant bit first
+void bits_put_code (Bit_Writer *w, u32 code, int length) {
+    u32 reversed = 0;
+    for (int i = 0; i < length; i++) reversed |= ((code >> i) & 1) << (length - 1 - i);
+    bits_put(w, reversed, length);
+}
+
+// deflate with the fixed codes
+
+const u16 deflate_length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+const u8 deflate_length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+const u16 deflate_distance_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+const u8 deflate_distance_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+#define DEFLATE_WINDOW 32768
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_MAX_CHAIN 32
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+
+void deflate_put_symbol (Bit_Writer *w, int symbol) {
+    if      (symbol < 144) bits_put_code(w, 0x30 + symbol, 8);
+    else if (symbol < 256) bits_put_code(w, 0x190 + symbol - 144, 9);
+    else if (symbol < 280) bits_put_code(w, symbol - 256, 7);
+    else                   bits_put_code(w, 0xC0 + symbol - 280, 8);
+}
+
+void deflate_put_match (Bit_Writer *w, int length, int distance) {
+    int l = 28;
+    while (deflate_length_base[l] > length) l--;
+    deflate_put_symbol(w, 257 + l);
+    bits_put(w, length - deflate_length_base[l], deflate_length_extra[l]);
+
+    int d = 29;
+    while (deflate_distance_base[d] > distance) d--;
+    bits_put_code(w, d, 5);
+    bits_put(w, distance - deflate_distance_base[d], deflate_distance_extra[d]);
+}
+
+u32 deflate_hash (const u8 *p) {
+    u32 v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (v * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+// compresses data as one fixed huffman block. if last is false it's followed
+// by an empty stored block so it ends on a byte boundary and more can come
+// after it
+void deflate_fixed (Bit_Writer *w, const u8 *data, size_t size, bool last) {
+    int *head = malloc((1 << DEFLATE_HASH_BITS) * sizeof(int));
+    int *prev = malloc((size ? size : 1) * sizeof(int));
+    for (int i = 0; i < (1 << DEFLATE_HASH_BITS); i++) head[i] = -1;
+
+    bits_put(w, last ? 1 : 0, 1);
+    bits_put(w, 1, 2); // fixed codes
+
+    size_t i = 0;
+    while (i < size) {
+        int best_length = 0;
+        int best_distance = 0;
+
+        if (i + DEFLATE_MIN_MATCH <= size) {
+            u32 h = deflate_hash(&data[i]);
+            int max_length = size - i < DEFLATE_MAX_MATCH ? (int) (size - i) : DEFLATE_MAX_MATCH;
+
+            int candidate = head[h];
+            for (int chain = 0; chain < DEFLATE_MAX_CHAIN && candidate >= 0; chain++) {
+                if (i - candidate > DEFLATE_WINDOW) break;
+
+                int length = 0;
+                while (length < max_length && data[candidate + length] == data[i + length]) length++;
+                if (length > best_length) {
+                    best_length = length;
+                    best_distance = (int) (i - candidate);
+                    if (length == max_length) break;
+                }
+                candidate = prev[candidate];
+            }
+        }
+
+        int step = 1;
+        if (best_length >= DEFLATE_MIN_MATCH) {
+            deflate_put_match(w, best_length, best_distance);
+            step = best_length;
+        } else {
+            deflate_put_symbol(w, data[i]);
+        }
+
+        // every position gets into the hash, also the ones inside the match
+        for (int s = 0; s < step; s++, i++) {
+            if (i + DEFLATE_MIN_MATCH <= size) {
+                u32 h = deflate_hash(&data[i]);
+                prev[i] = head[h];
+                head[h] = (int) i;
+            }
+        }
+    }
+
+    deflate_put_symbol(w, 256); // end of block
+
+    if (!last) {
+        bits_put(w, 0, 3); // not last, stored
+        bits_align(w);
+        bits_put(w, 0x0000, 16);
+        bits_put(w, 0xFFFF, 16);
+    }
+    bits_align(w);
+
+    free(head);
+    free(prev);
+}
+
+// encoding the strips
+
+u8 paeth (int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return (u8) a;
+    if (pb <= pc) return (u8) b;
+    return (u8) c;
+}
+
+// filters one row of rgb bytes into out (which starts with the filter type)
+// with whichever png filter makes the smallest numbers, that's the usual
+// guess for what compresses best
+void png_filter_row (const u8 *row, const u8 *above, int size, u8 *out, u8 *scratch) {
+    long best_score = -1;
+
+    for (int filter = 0; filter < 5; filter++) {
+        long score = 0;
+        for (int i = 0; i < size; i++) {
+            int left = i >= 3 ? row[i - 3] : 0;
+            int up = above[i];
+            int up_left = i >= 3 ? above[i - 3] : 0;
+
+            u8 v = row[i];
+            switch (filter) {
+                case 1: v -= left; break;
+                case 2: v -= up; break;
+                case 3: v -= (left + up) / 2; break;
+                case 4: v -= paeth(left, up, up_left); break;
+            }
+            scratch[i] = v;
+            score += v < 128 ? v : 256 - v;
+        }
+
+        if (best_score < 0 || score < best_score) {
+            best_score = score;
+            out[0] = (u8) filter;
+            memcpy(out + 1, scratch, size);
+        }
+    }
+}
+
+void strip_reserve (Encoder_Strip *strip, size_t size) {
+    if (size > strip->data_capacity) {
+        strip->data = realloc(strip->data, size);
+        strip->data_capacity = size;
+    }
+}
+
+void put_u32_big_endian (u8 *p, u32 v) {
+    p[0] = (u8) (v >> 24);
+    p[1] = (u8) (v >> 16);
+    p[2] = (u8) (v >> 8);
+    p[3] = (u8) v;
+}
+
+void encode_strip (Image_Encoder *encoder, Encoder_Strip *strip) {
+    int width = encoder->width;
+    int rows = strip->rows;
+
+    if (encoder->format == IMAGE_HDR) {
+        strip->size = (size_t) width * rows * 4;
+        strip_reserve(strip, strip->size);
+        for (int i = 0; i < width * rows; i++) rgbe_encode(strip->colors[width + i], &strip->data[i * 4]);
+        return;
+    }
+
+    // the row above too for the png filters
+    u32 *pixels = malloc((size_t) width * (rows + 1) * sizeof(u32));
+    tonemap_pixels(&encoder->tonemap, strip->colors, pixels, width * (rows + 1));
+    if (strip->index == 0) memset(pixels, 0, width * sizeof(u32));
+
+    u8 *rgb = malloc((size_t) width * (rows + 1) * 3);
+    for (int i = 0; i < width * (rows + 1); i++) {
+        rgb[i * 3 + 0] = (u8) (pixels[i] >> 16);
+        rgb[i * 3 + 1] = (u8) (pixels[i] >> 8);
+        rgb[i * 3 + 2] = (u8) pixels[i];
+    }
+    free(pixels);
+
+    int row_size = width * 3;
+
+    if (encoder->format == IMAGE_PPM) {
+        strip->size = (size_t) row_size * rows;
+        strip_reserve(strip, strip->size);
+        memcpy(strip->data, rgb + row_size, strip->size);
+        free(rgb);
+        return;
+    }
+
+    // png: filter, deflate, then wrap it up as an IDAT chunk
+    strip->raw_size = (size_t) (row_size + 1) * rows;
+    u8 *raw = malloc(strip->raw_size);
+    u8 *scratch = malloc(row_size);
+    for (int y = 0; y < rows; y++) {
+        png_filter_row(rgb + (y + 1) * row_size, rgb + y * row_size, row_size, raw + y * (row_size + 1), scratch);
+    }
+    free(scratch);
+    free(rgb);
+
+    strip->adler = adler_update(1, raw, strip->raw_size);
+
+    Bit_Writer w = { .data = strip->data, .capacity = strip->data_capacity };
+    bits_reserve(&w, 8);
+    w.size = 8; // chunk length and type go here
+    deflate_fixed(&w, raw, strip->raw_size, strip->index == encoder->strip_count - 1);
+    free(raw);
+
+    bits_reserve(&w, 4);
+    u32 length = (u32) (w.size - 8);
+    put_u32_big_endian(w.data, length);
+    memcpy(w.data + 4, "IDAT", 4);
+    put_u32_big_endian(w.data + w.size, crc_update(0, w.data + 4, length + 4));
+    w.size += 4;
+
+    strip->data = w.data;
+    strip->data_capacity = w.capacity;
+    strip->size = w.size;
+}
+
+void png_write_chunk (FILE *file, const char *type, const u8 *data, u32 size) {
+    u8 header[8];
+    put_u32_big_endian(header, size);
+    memcpy(header + 4, type, 4);
+
+    u8 crc[4];
+    put_u32_big_endian(crc, crc_update(crc_update(0, header + 4, 4), data, size));
+
+    fwrite(header, 1, 8, file);
+    fwrite(data, 1, size, file);
+    fwrite(crc, 1, 4, file);
+}
+
+// the threads
+
+void encoder_thread (void *param) {
+    Image_Encoder *encoder = param;
+
+    mutex_lock(&encoder->lock);
+    for (;;) {
+        if (encoder->next_encode < encoder->strips_full) {
+            Encoder_Strip *strip = &encoder->slots[encoder->next_encode % encoder->slot_count];
+            encoder->next_encode++;
+
+            mutex_unlock(&encoder->lock);
+            encode_strip(encoder, strip);
+            mutex_lock(&encoder->lock);
+
+            strip->ready = true;
+
+            // whoever finishes the strip that's next writes out everything
+            // that's ready, the others keep encoding
+            while (!encoder->writing && encoder->next_write < encoder->strip_count) {
+                Encoder_Strip *next = &encoder->slots[encoder->next_write % encoder->slot_count];
+                if (!next->ready) break;
+
+                encoder->writing = true;
+                mutex_unlock(&encoder->lock);
+
+                bool ok = fwrite(next->data, 1, next->size, encoder->file) == next->size;
+                if (encoder->format == IMAGE_PNG) {
+                    encoder->adler = adler_combine(encoder->adler, next->adler, next->raw_size);
+                }
+
+                mutex_lock(&encoder->lock);
+                if (!ok) encoder->failed = true;
+                next->ready = false;
+                encoder->next_write++;
+                encoder->writing = false;
+                condition_wake_all(&encoder->changed);
+            }
+            continue;
+        }
+
+        if (encoder->closing && encoder->next_encode == encoder->strips_full) break;
+        condition_wait(&encoder->changed, &encoder->lock);
+    }
+    mutex_unlock(&encoder->lock);
+}
+
+// opens the file and starts the threads, NULL if the file can't be made.
+// tonemap is used for ppm and png
+Image_Encoder *image_encoder_open (
+    const char *path, Image_Format format, int width, int height,
+    const Tonemap *tonemap, int thread_count
+) {
+    FILE *file = fopen(path, "wb");
+    if (!file) return NULL;
+
+    if (thread_count < 1) thread_count = 1;
+
+    Image_Encoder *encoder = calloc(1, sizeof(Image_Encoder));
+    encoder->file = file;
+    encoder->format = format;
+    encoder->width = width;
+    encoder->height = height;
+    encoder->tonemap = *tonemap;
+    encoder->strip_count = (height + ENCODER_STRIP_ROWS - 1) / ENCODER_STRIP_ROWS;
+    encoder->adler = 1;
+
+    // enough that every thread has one to encode and one waiting
+    encoder->slot_count = thread_count * 2 + 1;
+    encoder->slots = calloc(encoder->slot_count, sizeof(Encoder_Strip));
+
+    if (format == IMAGE_PPM) {
+        fprintf(file, "P6\n%d %d\n255\n", width, height);
+    } else if (format == IMAGE_HDR) {
+        fprintf(file, "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y %d +X %d\n", height, width);
+    } else {
+        crc_init();
+        fwrite("\x89PNG\r\n\x1a\n", 1, 8, file);
+
+        u8 header[13];
+        put_u32_big_endian(header, width);
+        put_u32_big_endian(header + 4, height);
+        header[8] = 8;  // bits per channel
+        header[9] = 2;  // rgb
+        header[10] = 0; // deflate
+        header[11] = 0; // the usual filters
+        header[12] = 0; // not interlaced
+        png_write_chunk(file, "IHDR", header, 13);
+
+        // zlib header, deflate with a 32k window and no dictionary
+        const u8 zlib_header[2] = { 0x78, 0x01 };
+        png_write_chunk(file, "IDAT", zlib_header, 2);
+    }
+
+    mutex_init(&encoder->lock);
+    condition_init(&encoder->changed);
+
+    encoder->thread_count = thread_count;
+    encoder->threads = malloc(thread_count * sizeof(Thread));
+    for (int i = 0; i < thread_count; i++) encoder->threads[i] = thread_start(encoder_thread, encoder);
+
+    return encoder;
+}
+
+// hands in the next count rows of the image. it waits if the encoding is so
+// far behind that there's no free strip to put them in
+void image_encoder_rows (Image_Encoder *encoder, const Color *colors, int count) {
+    int width = encoder->width;
+
+    while (count > 0 && encoder->rows_in < encoder->height) {
+        int s = encoder->rows_in / ENCODER_STRIP_ROWS;
+        int row_in_strip = encoder->rows_in % ENCODER_STRIP_ROWS;
+        Encoder_Strip *strip = &encoder->slots[s % encoder->slot_count];
+
+        if (row_in_strip == 0) {
+            // wait for the slot to be written out and free
+            mutex_lock(&encoder->lock);
+            while (s - encoder->next_write >= encoder->slot_count) {
+                condition_wait(&encoder->changed, &encoder->lock);
+            }
+            mutex_unlock(&encoder->lock);
+
+            int rows = encoder->height - s * ENCODER_STRIP_ROWS;
+            if (rows > ENCODER_STRIP_ROWS) rows = ENCODER_STRIP_ROWS;
+
+            strip->index = s;
+            strip->y = s * ENCODER_STRIP_ROWS;
+            strip->rows = rows;
+
+            int needed = width * (ENCODER_STRIP_ROWS + 1);
+            if (needed > strip->capacity) {
+                strip->colors = realloc(strip->colors, needed * sizeof(Color));
+                strip->capacity = needed;
+            }
+
+            // the row above, which is the last row of the previous strip
+            if (s == 0) {
+                memset(strip->colors, 0, width * sizeof(Color));
+            } else {
+                Encoder_Strip *previous = &encoder->slots[(s - 1) % encoder->slot_count];
+                memcpy(strip->colors, &previous->colors[width * ENCODER_STRIP_ROWS], width * sizeof(Color));
+            }
+        }
+
+        int rows = strip->rows - row_in_strip;
+        if (rows > count) rows = count;
+
+        memcpy(&strip->colors[width * (row_in_strip + 1)], colors, (size_t) width * rows * sizeof(Color));
+        colors += (size_t) width * rows;
+        count -= rows;
+        encoder->rows_in += rows;
+
+        if (row_in_strip + rows == strip->rows) {
+            mutex_lock(&encoder->lock);
+            encoder->strips_full++;
+            condition_wake_all(&encoder->changed);
+            mutex_unlock(&encoder->lock);
+        }
+    }
+}
+
+// waits for everything to be written and closes the file, false if
+// anything went wrong or not all the rows were handed in
+bool image_encoder_close (Image_Encoder *encoder) {
+    mutex_lock(&encoder->lock);
+    encoder->closing = true;
+    condition_wake_all(&encoder->changed);
+    mutex_unlock(&encoder->lock);
+
+    for (int i = 0; i < encoder->thread_count; i++) thread_join(encoder->threads[i]);
+
+    bool ok = !encoder->failed && encoder->rows_in == encoder->height;
+
+    if (ok && encoder->format == IMAGE_PNG) {
+        u8 adler[4];
+        put_u32_big_endian(adler, encoder->adler);
+        png_write_chunk(encoder->file, "IDAT", adler, 4);
+        png_write_chunk(encoder->file, "IEND", NULL, 0);
+    }
+
+    if (ferror(encoder->file)) ok = false;
+    if (fclose(encoder->file) != 0) ok = false;
+
+    for (int i = 0; i < encoder->slot_count; i++) {
+        free(encoder->slots[i].colors);
+        free(encoder->slots[i].data);
+    }
+    free(encoder->slots);
+    free(encoder->threads);
+    mutex_free(&encoder->lock);
+    condition_free(&encoder->changed);
+    free(encoder);
+
+    return ok;
+}
@@ -0,0 +1,479 @@
+// renders the scene without a window and writes it out as a ppm
+//
+//     headless [-o out.ppm|out.png|out.hdr] [-w width] [-h height]
+//              [-s samples] [-f fast_math] [-m pixel|batched|wavefront]
+//              [-H 0|1] [-e exposure] [-c clamp|reinhard] [-g gamma|srgb]
+//              [-i in.hdr] [-j threads] [-k checkpoint] [-p seconds]
+//              [-r 0|1] [-S grid|jitter|halton|sobol|blue] [-a light_size]
+//              [-d 0|1] [-R x,y,width,height]... [-b earlier.hdr] [-C 0|1]
+//              [-A frames] [-T 0|1] [-n 0|1]
+//
+// -m picks how the image gets traced: trace_pixel one pixel at a time, the
+// batched shading kernels a row at a time (the default) or the whole frame
+// breadth first with trace_wavefront
+//
+// the whole frame is traced into float colors first and then tone mapped
+// (see tonemap.c) with -e, -c and -g. -H 1 stops light from being clamped
+// while shading (see color_add_light in raytrace_math.c), which is on by itself when
+// writing a .hdr file. a .hdr file can be given back with -i to tone map it
+// again without tracing anything
+//
+// the file gets written while the image is traced, rows go to the encoder
+// (see encoder.c) as they're done and -j threads tone map and encode them.
+// the default is one per cpu
+//
+// -S picks where in each pixel the samples go (see sampler.c). -a makes the
+// lights that big across for soft shadows (see light_visibility)
+//
+// -d 1 denoises the frame before it's tone mapped (see denoise.c), so a few
+// samples per pixel look like a lot more. it does the most at low sample
+// counts and backs off as they go up, there's less noise left to take out
+//
+// -R only traces that rectangle of the frame, it can be given up to
+// MAX_REGIONS times. the rest of the frame comes from -b, a .hdr of the same
+// size written by an earlier run, or is black without it. -d 1 only denoises
+// the rectangles, the rest is left as it came from -b. -C 1 only writes
+// out the part of the frame the rectangles cover. -w and -h can be bigger
+// than the window to look closely at something at full quality
+//
+// -A renders that many frames of the red sphere moving about (see
+// animate_scene) and -o has to have a %d in it for the frame number. -T 1
+// keeps the last frame around and only traces the pixels that could have
+// changed (see temporal.c), it says how many it got to keep for each frame
+//
+// -k renders a sample at a time over the whole image on -j threads instead
+// and saves a checkpoint to that file every -p seconds (30 by default).
+// -r 1 carries on from the checkpoint after being stopped (see
+// progressive.c). -n 1 keeps those threads on their own cpus and gives each
+// numa node its own part of the image, for machines with more than one
+// socket
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "render.c"
+#include "output.c"
+#include "encoder.c"
+#include "progressive.c"
+#include "denoise.c"
+#include "temporal.c"
+
+#define MAX_REGIONS 16
+
+typedef struct Region {
+    int x;
+    int y;
+    int width;
+    int height;
+} Region;
+
+bool ends_with (const char *text, const char *end) {
+    size_t text_length = strlen(text);
+    size_t end_length = strlen(end);
+    return text_length >= end_length && strcmp(text + text_length - end_length, end) == 0;
+}
+
+// traces the frame and hands the rows to the encoder as they're done. with
+// denoise the whole frame has to be there first, so it all goes at the end
+bool trace_frame (
+    const Render_State *state, Image_Encoder *encoder, int width, int height, int samples, const char *mode,
+    bool denoise, int threads
+) {
+    bool wavefront = strcmp(mode, "wavefront") == 0;
+    bool pixel = strcmp(mode, "pixel") == 0;
+    if (!wavefront && !pixel && strcmp(mode, "batched") != 0) return false;
+
+    Color *frame = NULL;
+    if (wavefront || denoise) frame = malloc((size_t) width * height * sizeof(Color));
+
+    if (wavefront) {
+        // this one does the whole frame at once
+        trace_wavefront(state, frame, 0, 0, width, height, width, height, samples);
+    } else {
+        // rows go straight into the frame when there is one
+        Color *row = frame ? NULL : malloc(width * sizeof(Color));
+        for (int y = 0; y < height; y++) {
+            if (frame) row = frame + (size_t) y * width;
+
+            if (pixel) {
+                for (int x = 0; x < width; x++) row[x] = trace_pixel(state, x, y, width, height, samples);
+            } else {
+                trace_block(state, row, 0, y, width, 1, width, height, samples);
+            }
+            if (!frame) image_encoder_rows(encoder, row, 1);
+        }
+        if (!frame) free(row);
+    }
+
+    if (frame) {
+        if (denoise) denoise_frame(state, frame, width, height, samples, threads);
+        image_encoder_rows(encoder, frame, height);
+        free(frame);
+    }
+    return true;
+}
+
+// clips it to the frame, false if nothing is left
+bool parse_region (const char *text, int width, int height, Region *region) {
+    Region r;
+    if (sscanf(text, "%d,%d,%d,%d", &r.x, &r.y, &r.width, &r.height) != 4) return false;
+
+    int x1 = r.x + r.width > width ? width : r.x + r.width;
+    int y1 = r.y + r.height > height ? height : r.y + r.height;
+    if (r.x < 0) r.x = 0;
+    if (r.y < 0) r.y = 0;
+    r.width = x1 - r.x;
+    r.height = y1 - r.y;
+
+    *region = r;
+    return r.width > 0 && r.height > 0;
+}
+
+// traces just the regions into frame (which already has whatever should be
+// around them) the same way trace_frame would
+bool trace_regions (
+    const Render_State *state, Color *frame, int width, int height, int samples, const char *mode,
+    const Region *regions, int region_count
+) {
+    bool wavefront = strcmp(mode, "wavefront") == 0;
+    bool pixel = strcmp(mode, "pixel") == 0;
+    if (!wavefront && !pixel && strcmp(mode, "batched") != 0) return false;
+
+    for (int i = 0; i < region_count; i++) {
+        Region r = regions[i];
+        Color *colors = malloc((size_t) r.width * r.height * sizeof(Color));
+
+        if (wavefront) {
+            trace_wavefront(state, colors, r.x, r.y, r.width, r.height, width, height, samples);
+        } else if (pixel) {
+            for (int y = 0; y < r.height; y++) {
+                for (int x = 0; x < r.width; x++) {
+                    colors[y * r.width + x] = trace_pixel(state, r.x + x, r.y + y, width, height, samples);
+                }
+            }
+        } else {
+            trace_block(state, colors, r.x, r.y, r.width, r.height, width, height, samples);
+        }
+
+        for (int y = 0; y < r.height; y++) {
+            memcpy(frame + (size_t) (r.y + y) * width + r.x, colors + (size_t) y * r.width, r.width * sizeof(Color));
+        }
+        free(colors);
+    }
+    return true;
+}
+
+// denoises just the regions of frame. each one is denoised with
+// DENOISE_REACH pixels of what's around it so it comes out the same as it
+// would in the whole frame, but only the region itself gets written back, the rest
+// of frame (what came from -b) stays as it was. the windows are all copied
+// out first so regions close together don't blur in each other's results
+void denoise_regions (
+    const Render_State *state, Color *frame, int width, int height, int samples, int threads,
+    const Region *regions, int region_count
+) {
+    Region windows[MAX_REGIONS];
+    Color *window_colors[MAX_REGIONS];
+
+    for (int i = 0; i < region_count; i++) {
+        Region r = regions[i];
+        Region w = {r.x - DENOISE_REACH, r.y - DENOISE_REACH, r.width + 2 * DENOISE_REACH, r.height + 2 * DENOISE_REACH};
+        int x1 = w.x + w.width > width ? width : w.x + w.width;
+        int y1 = w.y + w.height > height ? height : w.y + w.height;
+        if (w.x < 0) w.x = 0;
+        if (w.y < 0) w.y = 0;
+        w.width = x1 - w.x;
+        w.height = y1 - w.y;
+        windows[i] = w;
+
+        window_colors[i] = malloc((size_t) w.width * w.height * sizeof(Color));
+        for (int y = 0; y < w.height; y++) {
+            memcpy(window_colors[i] + (size_t) y * w.width, frame + (size_t) (w.y + y) * width + w.x, w.width * sizeof(Color));
+        }
+    }
+
+    for (int i = 0; i < region_count; i++) {
+        Region r = regions[i];
+        Region w = windows[i];
+        denoise_window(state, window_colors[i], w.x, w.y, w.width, w.height, width, height, samples, threads);
+
+        for (int y = 0; y < r.height; y++) {
+            memcpy(
+                frame + (size_t) (r.y + y) * width + r.x,
+                window_colors[i] + (size_t) (r.y - w.y + y) * w.width + (r.x - w.x),
+                r.width * sizeof(Color)
+            );
+        }
+        free(window_colors[i]);
+    }
+}
+
+// the red sphere goes round in a little circle, everything else stays put
+void animate_scene (Render_State *state, int frame, int frame_count) {
+    float angle = 2.0f * 3.14159265f * (float) frame / (float) frame_count;
+    state->scene[1].sphere.pos.x += 1.5f * cosf(angle) - 1.5f;
+    state->scene[1].sphere.pos.z += 1.5f * sinf(angle);
+}
+
+bool render_animation (
+    Render_State *state, const char *output, Image_Format format, Tonemap *tonemap,
+    int width, int height, int samples, const char *mode,
+    bool denoise, int threads, int frame_count, bool temporal
+) {
+    Temporal_Cache cache;
+    Color *frame = NULL;
+    if (temporal) {
+        temporal_init(&cache, width, height, samples);
+        frame = malloc((size_t) width * height * sizeof(Color));
+    }
+
+    bool ok = true;
+    for (int f = 0; f < frame_count && ok; f++) {
+        char path[1024];
+        snprintf(path, sizeof(path), output, f);
+
+        Image_Encoder *encoder = image_encoder_open(path, format, width, height, tonemap, threads);
+        if (!encoder) {
+            fprintf(stderr, "couldn't write %s\n", path);
+            ok = false;
+            break;
+        }
+
+        setup_scene(state);
+        animate_scene(state, f, frame_count);
+
+        if (temporal) {
+            int reused = temporal_trace_frame(&cache, state);
+            fprintf(stderr, "frame %d: kept %d of %d pixels (%.1f%%)\n",
+                f, reused, width * height, 100.0f * (float) reused / (float) (width * height));
+
+            // the cache has to stay as it was traced for next time
+            memcpy(frame, cache.colors, (size_t) width * height * sizeof(Color));
+            if (denoise) denoise_frame(state, frame, width, height, samples, threads);
+            image_encoder_rows(encoder, frame, height);
+        } else if (!trace_frame(state, encoder, width, height, samples, mode, denoise, threads)) {
+            fprintf(stderr, "unknown mode %s\n", mode);
+            ok = false;
+        }
+
+        if (!image_encoder_close(encoder) && ok) {
+            fprintf(stderr, "couldn't write %s\n", path);
+            ok = false;
+        }
+    }
+
+    if (temporal) {
+        temporal_free(&cache);
+        free(frame);
+    }
+    return ok;
+}
+
+int main (int argc, char **argv) {
+    Render_State state = DEFAULT_RENDER_STATE;
+    const char *output = "raytrace.ppm";
+    const char *input = NULL;
+    int width = 1280;
+    int height = 720;
+    int samples = 1;
+    const char *mode = "batched";
+    int hdr_shading = -1; // -1 is up to the output file
+    int threads = cpu_count();
+    const char *checkpoint = NULL;
+    int checkpoint_seconds = 30;
+    int resume = 0;
+    int denoise = 0;
+    const char *region_texts[MAX_REGIONS];
+    int region_count = 0;
+    const char *base = NULL;
+    int crop = 0;
+    int frame_count = 0;
+    int temporal = 0;
+    int numa = 0;
+
+    float exposure = 0.0f;
+    Tonemap_Curve curve = TONEMAP_CLAMP;
+    float gamma = 1.0f;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if      (strcmp(argv[i], "-o") == 0) output = argv[i + 1];
+        else if (strcmp(argv[i], "-i") == 0) input = argv[i + 1];
+        else if (strcmp(argv[i], "-w") == 0) width = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-h") == 0) height = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-s") == 0) samples = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-f") == 0) state.fast_math = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-m") == 0) mode = argv[i + 1];
+        else if (strcmp(argv[i], "-H") == 0) hdr_shading = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-j") == 0) threads = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-k") == 0) checkpoint = argv[i + 1];
+        else if (strcmp(argv[i], "-p") == 0) checkpoint_seconds = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-r") == 0) resume = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-d") == 0) denoise = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-R") == 0) {
+            if (region_count == MAX_REGIONS) {
+                fprintf(stderr, "too many regions (max %d)\n", MAX_REGIONS);
+                return 1;
+            }
+            region_texts[region_count++] = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "-b") == 0) base = argv[i + 1];
+        else if (strcmp(argv[i], "-C") == 0) crop = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-A") == 0) frame_count = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-T") == 0) temporal = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-n") == 0) numa = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-a") == 0) state.light_size = (float) atof(argv[i + 1]);
+        else if (strcmp(argv[i], "-S") == 0 && sampler_from_name(argv[i + 1]) >= 0) state.sampler = sampler_from_name(argv[i + 1]);
+        else if (strcmp(argv[i], "-e") == 0) exposure = (float) atof(argv[i + 1]);
+        else if (strcmp(argv[i], "-c") == 0 && strcmp(argv[i + 1], "clamp") == 0) curve = TONEMAP_CLAMP;
+        else if (strcmp(argv[i], "-c") == 0 && strcmp(argv[i + 1], "reinhard") == 0) curve = TONEMAP_REINHARD;
+        else if (strcmp(argv[i], "-g") == 0) gamma = strcmp(argv[i + 1], "srgb") == 0 ? 0.0f : (float) atof(argv[i + 1]);
+        else {
+            fprintf(stderr, "unknown option %s %s\n", argv[i], argv[i + 1]);
+            return 1;
+        }
+    }
+
+    if (width <= 0 || height <= 0 || samples <= 0 || gamma < 0.0f) {
+        fprintf(stderr, "width, height, samples and gamma have to be positive\n");
+        return 1;
+    }
+
+    Image_Format format = IMAGE_PPM;
+    if (ends_with(output, ".png")) format = IMAGE_PNG;
+    if (ends_with(output, ".hdr")) format = IMAGE_HDR;
+
+    state.hdr = hdr_shading < 0 ? format == IMAGE_HDR : hdr_shading != 0;
+
+    if (resume && !checkpoint) {
+        fprintf(stderr, "-r needs a checkpoint file from -k\n");
+        return 1;
+    }
+
+    // the regions are clipped to the frame, crop is the box around all of them
+    Region regions[MAX_REGIONS];
+    Region cropped = {0, 0, width, height};
+    for (int i = 0; i < region_count; i++) {
+        if (!parse_region(region_texts[i], width, height, &regions[i])) {
+            fprintf(stderr, "-R %s isn't x,y,width,height inside the frame\n", region_texts[i]);
+            return 1;
+        }
+
+        Region r = regions[i];
+        if (i == 0) {
+            cropped = r;
+        } else {
+            int x1 = cropped.x + cropped.width > r.x + r.width ? cropped.x + cropped.width : r.x + r.width;
+            int y1 = cropped.y + cropped.height > r.y + r.height ? cropped.y + cropped.height : r.y + r.height;
+            if (r.x < cropped.x) cropped.x = r.x;
+            if (r.y < cropped.y) cropped.y = r.y;
+            cropped.width = x1 - cropped.x;
+            cropped.height = y1 - cropped.y;
+        }
+    }
+
+    if ((base || crop) && region_count == 0) {
+        fprintf(stderr, "-b and -C only go with -R\n");
+        return 1;
+    }
+    if (region_count && (input || checkpoint)) {
+        fprintf(stderr, "-R can't go with -i or -k\n");
+        return 1;
+    }
+    if (temporal && frame_count <= 0) {
+        fprintf(stderr, "-T only goes with -A\n");
+        return 1;
+    }
+    if (frame_count > 0 && (region_count || input || checkpoint || !strstr(output, "%d"))) {
+        fprintf(stderr, "-A needs a %%d in -o for the frame number and can't go with -R, -i or -k\n");
+        return 1;
+    }
+
+    // these render the whole image before anything gets written
+    Color *input_colors = NULL;
+    if (input) {
+        input_colors = read_hdr(input, &width, &height);
+        if (!input_colors) {
+            fprintf(stderr, "couldn't read %s\n", input);
+            return 1;
+        }
+    } else if (checkpoint) {
+        setup_scene(&state);
+        input_colors = render_progressive(
+            &state, width, height, samples, PROGRESSIVE_TILE_SIZE, threads,
+            checkpoint, checkpoint_seconds, resume != 0, numa != 0
+        );
+        if (!input_colors) return 1;
+        if (denoise) denoise_frame(&state, input_colors, width, height, samples, threads);
+    } else if (region_count) {
+        if (base) {
+            int base_width, base_height;
+            input_colors = read_hdr(base, &base_width, &base_height);
+            if (!input_colors || base_width != width || base_height != height) {
+                fprintf(stderr, "couldn't read %s as a %dx%d .hdr\n", base, width, height);
+                free(input_colors);
+                return 1;
+            }
+        } else {
+            input_colors = calloc((size_t) width * height, sizeof(Color));
+        }
+
+        setup_scene(&state);
+        if (!trace_regions(&state, input_colors, width, height, samples, mode, regions, region_count)) {
+            fprintf(stderr, "unknown mode %s\n", mode);
+            free(input_colors);
+            return 1;
+        }
+        if (denoise) denoise_regions(&state, input_colors, width, height, samples, threads, regions, region_count);
+
+        if (crop) {
+            Color *colors = malloc((size_t) cropped.width * cropped.height * sizeof(Color));
+            for (int y = 0; y < cropped.height; y++) {
+                memcpy(
+                    colors + (size_t) y * cropped.width,
+                    input_colors + (size_t) (cropped.y + y) * width + cropped.x,
+                    cropped.width * sizeof(Color)
+                );
+            }
+            free(input_colors);
+            input_colors = colors;
+            width = cropped.width;
+            height = cropped.height;
+        }
+    }
+
+    Tonemap tonemap;
+    tonemap_init(&tonemap, exposure, curve, gamma);
+
+    if (frame_count > 0) {
+        bool ok = render_animation(
+            &state, output, format, &tonemap, width, height, samples, mode,
+            denoise != 0, threads, frame_count, temporal != 0
+        );
+        return ok ? 0 : 1;
+    }
+
+    Image_Encoder *encoder = image_encoder_open(output, format, width, height, &tonemap, threads);
+    if (!encoder) {
+        fprintf(stderr, "couldn't write %s\n", output);
+        return 1;
+    }
+
+    if (input_colors) {
+        image_encoder_rows(encoder, input_colors, height);
+        free(input_colors);
+    } else {
+        setup_scene(&state);
+        if (!trace_frame(&state, encoder, width, height, samples, mode, denoise != 0, threads)) {
+            fprintf(stderr, "unknown mode %s\n", mode);
+            image_encoder_close(encoder);
+            return 1;
+        }
+    }
+
+    if (!image_encoder_close(encoder)) {
+        fprintf(stderr, "couldn't write %s\n", output);
+        return 1;
+    }
+
+    return 0;
+}
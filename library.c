@@ -0,0 +1,179 @@
+// the functions in raytrace.h. a context has its own render state (see
+// Render_State in raytrace_math.c) and a render traces from a copy of it
+// with the settings put in, so nothing is shared between contexts
+//
+// the rendering hands out tiles of the region to the threads the same way
+// poster.c does, the callback and cancelling happen between tiles
+
+#include "raytrace.h"
+#include "render.c"
+
+struct Raytrace_Context {
+    Render_State state;
+
+    // for cancelled and the tile counts of the render that's going
+    Mutex lock;
+    bool cancelled;
+};
+
+typedef struct Library_Render {
+    Raytrace_Context *context;
+    Render_State state; // the context's with the settings put in
+    Raytrace_Settings settings;
+    Raytrace_Region region;
+    float *rgb;
+
+    Raytrace_Tile_Callback callback;
+    void *user;
+
+    int tiles_x;
+    int tile_count;
+    int next_tile;
+    int tiles_done;
+} Library_Render;
+
+Raytrace_Context *raytrace_create (void) {
+    Raytrace_Context *context = calloc(1, sizeof(Raytrace_Context));
+    mutex_init(&context->lock);
+
+    context->state = (Render_State) DEFAULT_RENDER_STATE;
+    setup_scene(&context->state);
+    return context;
+}
+
+void raytrace_destroy (Raytrace_Context *context) {
+    if (!context) return;
+    mutex_free(&context->lock);
+    free(context);
+}
+
+void raytrace_default_scene (Raytrace_Context *context, float size) {
+    context->state.light_size = size;
+    setup_scene(&context->state);
+}
+
+int raytrace_load_scene (Raytrace_Context *context, const void *blob, unsigned int size) {
+    return scene_unpack(&context->state, blob, size);
+}
+
+void raytrace_set_camera (
+    Raytrace_Context *context,
+    const float pos[3], const float forward[3], const float left[3], const float up[3],
+    float zoom
+) {
+    Camera *c = &context->state.camera;
+    c->pos = (Vector3) {pos[0], pos[1], pos[2]};
+    c->forward = (Vector3) {forward[0], forward[1], forward[2]};
+    c->left = (Vector3) {left[0], left[1], left[2]};
+    c->up = (Vector3) {up[0], up[1], up[2]};
+    c->zoom = zoom;
+}
+
+Raytrace_Settings raytrace_default_settings (int width, int height) {
+    return (Raytrace_Settings) {
+        .width = width,
+        .height = height,
+        .samples = 1,
+        .threads = 0,
+        .tile_size = 32,
+        .fast_math = FAST_MATH,
+        .hdr = 0,
+        .sampler = RAYTRACE_SAMPLER_GRID
+    };
+}
+
+void library_render_thread (void *param) {
+    Library_Render *render = param;
+    Raytrace_Context *context = render->context;
+    Raytrace_Settings *settings = &render->settings;
+    Raytrace_Region *region = &render->region;
+
+    int size = settings->tile_size;
+    Color *colors = malloc(size * size * sizeof(Color));
+
+    for (;;) {
+        mutex_lock(&context->lock);
+        int t = context->cancelled ? render->tile_count : render->next_tile++;
+        mutex_unlock(&context->lock);
+        if (t >= render->tile_count) break;
+
+        int x = region->x + (t % render->tiles_x) * size;
+        int y = region->y + (t / render->tiles_x) * size;
+        int width = x + size > region->x + region->width ? region->x + region->width - x : size;
+        int height = y + size > region->y + region->height ? region->y + region->height - y : size;
+
+        trace_block(&render->state, colors, x, y, width, height, settings->width, settings->height, settings->samples);
+
+        for (int row = 0; row < height; row++) {
+            float *out = render->rgb + ((size_t) (y - region->y + row) * region->width + (x - region->x)) * 3;
+            for (int i = 0; i < width; i++) {
+                Color color = colors[row * width + i];
+                out[i * 3 + 0] = color.r;
+                out[i * 3 + 1] = color.g;
+                out[i * 3 + 2] = color.b;
+            }
+        }
+
+        mutex_lock(&context->lock);
+        int done = ++render->tiles_done;
+        mutex_unlock(&context->lock);
+
+        if (render->callback) render->callback(render->user, x, y, width, height, done, render->tile_count);
+    }
+
+    free(colors);
+}
+
+Raytrace_Result raytrace_render (
+    Raytrace_Context *context, const Raytrace_Settings *settings,
+    const Raytrace_Region *region, float *rgb,
+    Raytrace_Tile_Callback callback, void *user
+) {
+    Library_Render render = {
+        .context = context,
+        .settings = *settings,
+        .region = region ? *region : (Raytrace_Region) {0, 0, settings->width, settings->height},
+        .rgb = rgb,
+        .callback = callback,
+        .user = user
+    };
+
+    Raytrace_Settings *s = &render.settings;
+    Raytrace_Region *r = &render.region;
+    if (s->width <= 0 || s->height <= 0 || s->samples <= 0 || s->tile_size <= 0) return RAYTRACE_BAD_SETTINGS;
+    if (s->sampler < RAYTRACE_SAMPLER_GRID || s->sampler > RAYTRACE_SAMPLER_BLUE) return RAYTRACE_BAD_SETTINGS;
+    if (r->x < 0 || r->y < 0 || r->width <= 0 || r->height <= 0) return RAYTRACE_BAD_SETTINGS;
+    if (r->x + r->width > s->width || r->y + r->height > s->height) return RAYTRACE_BAD_SETTINGS;
+
+    render.tiles_x = (r->width + s->tile_size - 1) / s->tile_size;
+    render.tile_count = render.tiles_x * ((r->height + s->tile_size - 1) / s->tile_size);
+
+    int threads = s->threads > 0 ? s->threads : cpu_count();
+    if (threads > render.tile_count) threads = render.tile_count;
+
+    // the settings only last for this render, so they aren't kept
+    render.state = context->state;
+    render.state.fast_math = s->fast_math;
+    render.state.hdr = s->hdr != 0;
+    render.state.sampler = (Sampler) s->sampler;
+
+    Thread *pool = malloc(threads * sizeof(Thread));
+    for (int i = 0; i < threads; i++) pool[i] = thread_start(library_render_thread, &render);
+    for (int i = 0; i < threads; i++) thread_join(pool[i]);
+    free(pool);
+
+    // a cancel is used up by the render it stopped, this is the only place
+    // it gets cleared so one that comes in before the threads get going
+    // still counts
+    mutex_lock(&context->lock);
+    context->cancelled = false;
+    mutex_unlock(&context->lock);
+
+    return render.tiles_done < render.tile_count ? RAYTRACE_CANCELLED : RAYTRACE_OK;
+}
+
+void raytrace_cancel (Raytrace_Context *context) {
+    mutex_lock(&context->lock);
+    context->cancelled = true;
+    mutex_unlock(&context->lock);
+}
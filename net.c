@@ -0,0 +1,193 @@
+// little socket helpers for the programs that talk to each other. addresses
+// are either "unix:/some/path" for a unix socket or "host:port" for tcp.
+// this is posix only, there's no winsock version yet
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// every message starts with one of these, size is how many bytes come after
+typedef struct Net_Header {
+    u32 type;
+    u32 size;
+} Net_Header;
+
+bool net_is_unix (const char *address) {
+    return strncmp(address, "unix:", 5) == 0;
+}
+
+// splits "host:port" into its parts, host is "" for ":port"
+bool net_split_host_port (const char *address, char *host, int host_size, const char **port) {
+    const char *colon = strrchr(address, ':');
+    if (!colon || colon - address >= host_size) return false;
+
+    memcpy(host, address, colon - address);
+    host[colon - address] = 0;
+    *port = colon + 1;
+    return true;
+}
+
+// makes a listening socket, -1 if it doesn't work
+int net_listen (const char *address) {
+    if (net_is_unix(address)) {
+        struct sockaddr_un addr = {0};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, address + 5, sizeof(addr.sun_path) - 1);
+        unlink(addr.sun_path);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    char host[256];
+    const char *port;
+    if (!net_split_host_port(address, host, sizeof(host), &port)) return -1;
+
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    struct addrinfo *info;
+    if (getaddrinfo(host[0] ? host : NULL, port, &hints, &info) != 0) return -1;
+
+    int fd = -1;
+    for (struct addrinfo *a = info; a; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) continue;
+
+        int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+        if (bind(fd, a->ai_addr, a->ai_addrlen) == 0 && listen(fd, 64) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(info);
+    return fd;
+}
+
+// connects to a listening socket, -1 if it doesn't work
+int net_connect (const char *address) {
+    if (net_is_unix(address)) {
+        struct sockaddr_un addr = {0};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, address + 5, sizeof(addr.sun_path) - 1);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    char host[256];
+    const char *port;
+    if (!net_split_host_port(address, host, sizeof(host), &port)) return -1;
+
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *info;
+    if (getaddrinfo(host[0] ? host : "localhost", port, &hints, &info) != 0) return -1;
+
+    int fd = -1;
+    for (struct addrinfo *a = info; a; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) continue;
+        if (connect(fd, a->ai_addr, a->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(info);
+
+    // tiles are small messages that we want sent right away
+    if (fd >= 0) {
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    }
+
+    return fd;
+}
+
+int net_accept (int listen_fd) {
+    int fd = accept(listen_fd, NULL, NULL);
+
+    if (fd >= 0) {
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes)); // fails on unix sockets, that's fine
+    }
+
+    return fd;
+}
+
+// makes recv on fd give up after ms milliseconds, so a peer that stops
+// halfway through a message can't keep a single threaded loop waiting
+void net_set_recv_timeout (int fd, int ms) {
+    struct timeval timeout = { .tv_sec = ms / 1000, .tv_usec = (ms % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+bool net_send_all (int fd, const void *data, size_t size) {
+    const u8 *bytes = data;
+    while (size > 0) {
+        ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+bool net_recv_all (int fd, void *data, size_t size) {
+    u8 *bytes = data;
+    while (size > 0) {
+        ssize_t got = recv(fd, bytes, size, 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        bytes += got;
+        size -= got;
+    }
+    return true;
+}
+
+bool net_send_message (int fd, u32 type, const void *data, u32 size) {
+    Net_Header header = { type, size };
+    if (!net_send_all(fd, &header, sizeof(header))) return false;
+    return size == 0 || net_send_all(fd, data, size);
+}
+
+// reads a message into a buffer that gets grown as needed, false if the
+// connection is gone or the message is bigger than max_size. the size comes
+// from the other end, so max_size is what stops it from asking for any
+// amount of memory, and the connection should be dropped after a false
+bool net_recv_message (int fd, Net_Header *header, u8 **data, u32 *capacity, u32 max_size) {
+    if (!net_recv_all(fd, header, sizeof(*header))) return false;
+    if (header->size > max_size) return false;
+
+    if (header->size > *capacity) {
+        u8 *grown = realloc(*data, header->size);
+        if (!grown) return false;
+        *data = grown;
+        *capacity = header->size;
+    }
+
+    return header->size == 0 || net_recv_all(fd, *data, header->size);
+}
@@ -0,0 +1,125 @@
+// writing finished images out to files
+
+bool write_ppm (const char *path, u32 *image, int width, int height) {
+    FILE *file = fopen(path, "wb");
+    if (!file) return false;
+
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+
+    for (int i = 0; i < width * height; i++) {
+        u8 rgb[3] = {
+            (u8) (image[i] >> 16),
+            (u8) (image[i] >> 8),
+            (u8) image[i]
+        };
+        fwrite(rgb, 1, 3, file);
+    }
+
+    fclose(file);
+    return true;
+}
+
+// radiance .hdr, every pixel is rgb with a shared exponent (rgbe) so it
+// keeps the float colors from the tracer including anything past 1. these
+// get written by encoder.c
+
+void rgbe_encode (Color color, u8 *rgbe) {
+    float m = fmaxf(color.r, fmaxf(color.g, color.b));
+    if (m < 1e-32f) {
+        rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+        return;
+    }
+
+    int exponent;
+    float scale = frexpf(m, &exponent) * 256.0f / m;
+    rgbe[0] = (u8) (fmaxf(color.r, 0.0f) * scale);
+    rgbe[1] = (u8) (fmaxf(color.g, 0.0f) * scale);
+    rgbe[2] = (u8) (fmaxf(color.b, 0.0f) * scale);
+    rgbe[3] = (u8) (exponent + 128);
+}
+
+Color rgbe_decode (const u8 *rgbe) {
+    if (rgbe[3] == 0) return (Color) {0};
+    float scale = ldexpf(1.0f, (int) rgbe[3] - (128 + 8));
+    return (Color) {
+        (rgbe[0] + 0.5f) * scale,
+        (rgbe[1] + 0.5f) * scale,
+        (rgbe[2] + 0.5f) * scale
+    };
+}
+
+// reads one run length encoded scanline, the four channels come one after
+// the other
+bool read_hdr_rle_row (FILE *file, u8 *row, int width) {
+    for (int c = 0; c < 4; c++) {
+        for (int x = 0; x < width;) {
+            int count = fgetc(file);
+            if (count == EOF || count == 0) return false;
+
+            if (count > 128) {
+                count -= 128;
+                int value = fgetc(file);
+                if (value == EOF || x + count > width) return false;
+                for (int i = 0; i < count; i++) row[(x++) * 4 + c] = (u8) value;
+            } else {
+                if (x + count > width) return false;
+                for (int i = 0; i < count; i++) {
+                    int value = fgetc(file);
+                    if (value == EOF) return false;
+                    row[(x++) * 4 + c] = (u8) value;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// reads a .hdr with plain or run length encoded scanlines (not the old
+// radiance rle), NULL if it can't. the colors get malloced
+Color *read_hdr (const char *path, int *width, int *height) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+
+    // header lines until an empty one, then the size
+    char line[256];
+    bool format_ok = false;
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '\n') break;
+        if (strncmp(line, "FORMAT=", 7) == 0) format_ok = strcmp(line, "FORMAT=32-bit_rle_rgbe\n") == 0;
+    }
+
+    if (!format_ok || !fgets(line, sizeof(line), file) ||
+        sscanf(line, "-Y %d +X %d", height, width) != 2 || *width <= 0 || *height <= 0) {
+        fclose(file);
+        return NULL;
+    }
+
+    Color *colors = malloc((size_t) *width * *height * sizeof(Color));
+    u8 *row = malloc(*width * 4);
+    bool ok = true;
+
+    for (int y = 0; y < *height && ok; y++) {
+        u8 start[4];
+        ok = fread(start, 1, 4, file) == 4;
+        if (!ok) break;
+
+        if (start[0] == 2 && start[1] == 2 && ((start[2] << 8) | start[3]) == *width &&
+            *width >= 8 && *width < 32768) {
+            ok = read_hdr_rle_row(file, row, *width);
+        } else {
+            memcpy(row, start, 4);
+            ok = *width == 1 || fread(row + 4, 4, *width - 1, file) == (size_t) (*width - 1);
+        }
+
+        for (int x = 0; x < *width && ok; x++) colors[y * *width + x] = rgbe_decode(&row[x * 4]);
+    }
+
+    free(row);
+    fclose(file);
+
+    if (!ok) {
+        free(colors);
+        return NULL;
+    }
+    return colors;
+}
@@ -0,0 +1,317 @@
+// renders images that are too big to keep in memory, like a 100k x 100k
+// poster. the output file gets made at its full size up front and the
+// pixels are written straight into it through a memory mapping, one band of
+// tiles at a time, so only that band is ever mapped. the disk space is
+// taken up front too, and each band is flushed to the file before the next
+// one, so a full disk is an error instead of a crash (writing to a mapping
+// with nowhere to put it is SIGBUS) and it's found out early.
+//
+//     poster [-o out.ppm|out.hdr] [-w width] [-h height] [-s samples]
+//            [-f fast_math] [-t tile_size] [-j threads]
+//            [-e exposure] [-c clamp|reinhard] [-g gamma|srgb]
+//            [-S grid|jitter|halton|sobol|blue] [-a light_size]
+//
+// the tiles of a band get split between -j threads (one per cpu by
+// default). ppm and hdr both have a fixed number of bytes per pixel so a
+// tile knows where it goes in the file, which png doesn't (use headless for
+// that). writing a .hdr turns on hdr shading like headless does
+
+#include "render.c"
+#include "output.c"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+// a file that's been made at its full size, and the piece of it that's mapped
+
+typedef struct Mapped_File {
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+    u8 *view;      // what got mapped, starts on a page boundary
+    size_t view_size;
+    u8 *data;      // where the asked for range starts inside view
+} Mapped_File;
+
+size_t map_granularity () {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwAllocationGranularity;
+#else
+    return (size_t) sysconf(_SC_PAGESIZE);
+#endif
+}
+
+// makes the file, with header at the start, and grows it to size bytes
+// without writing them. the space for all of it gets set aside now so
+// writing through the mapping later can't run out
+bool mapped_file_create (Mapped_File *file, const char *path, const char *header, u64 size) {
+    memset(file, 0, sizeof(*file));
+    size_t header_size = strlen(header);
+
+#ifdef _WIN32
+    file->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file->file == INVALID_HANDLE_VALUE) return false;
+
+    DWORD written;
+    WriteFile(file->file, header, (DWORD) header_size, &written, 0);
+
+    file->mapping = CreateFileMappingA(file->file, 0, PAGE_READWRITE, (DWORD) (size >> 32), (DWORD) size, 0);
+    if (!file->mapping) {
+        CloseHandle(file->file);
+        return false;
+    }
+#else
+    file->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (file->fd < 0) return false;
+
+    if (write(file->fd, header, header_size) != (ssize_t) header_size || ftruncate(file->fd, (off_t) size) != 0) {
+        close(file->fd);
+        return false;
+    }
+
+    // glibc writes zeros itself on file systems that can't do this, so
+    // anything but 0 means the space really isn't there
+    int error = posix_fallocate(file->fd, 0, (off_t) size);
+    if (error != 0) {
+        fprintf(stderr, "couldn't set aside %llu bytes: %s\n", (unsigned long long) size, strerror(error));
+        close(file->fd);
+        unlink(path);
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+// writes out what's mapped and unmaps it, false if the writing failed
+bool mapped_file_unmap (Mapped_File *file) {
+    if (!file->view) return true;
+#ifdef _WIN32
+    bool ok = FlushViewOfFile(file->view, file->view_size) != 0;
+    UnmapViewOfFile(file->view);
+#else
+    bool ok = msync(file->view, file->view_size, MS_SYNC) == 0;
+    munmap(file->view, file->view_size);
+#endif
+    file->view = NULL;
+    file->data = NULL;
+    return ok;
+}
+
+// maps bytes offset to offset + size, they end up at file->data. whatever
+// was mapped before has to be unmapped first
+bool mapped_file_map (Mapped_File *file, u64 offset, size_t size) {
+    u64 start = offset - offset % map_granularity();
+    file->view_size = (size_t) (offset - start) + size;
+
+#ifdef _WIN32
+    file->view = MapViewOfFile(file->mapping, FILE_MAP_WRITE, (DWORD) (start >> 32), (DWORD) start, file->view_size);
+    if (!file->view) return false;
+#else
+    void *view = mmap(NULL, file->view_size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, (off_t) start);
+    if (view == MAP_FAILED) return false;
+    file->view = view;
+#endif
+
+    file->data = file->view + (offset - start);
+    return true;
+}
+
+bool mapped_file_close (Mapped_File *file) {
+    bool ok = mapped_file_unmap(file);
+#ifdef _WIN32
+    CloseHandle(file->mapping);
+    return CloseHandle(file->file) != 0 && ok;
+#else
+    return close(file->fd) == 0 && ok;
+#endif
+}
+
+// rendering the bands
+
+typedef struct Poster {
+    Render_State state;
+    int width;
+    int height;
+    int samples;
+    int tile_size;
+    bool write_float;
+    int bytes_per_pixel;
+    Tonemap tonemap;
+
+    // the band that's being rendered right now
+    u8 *band;   // first byte of the band's first row in the mapping
+    int band_y;
+    int band_height;
+    int tiles_in_band;
+
+    Mutex lock;
+    int next_tile;
+} Poster;
+
+void render_poster_tile (Poster *poster, int t, Color *colors, u32 *pixels) {
+    int x = t * poster->tile_size;
+    int width = poster->tile_size;
+    if (x + width > poster->width) width = poster->width - x;
+    int height = poster->band_height;
+
+    trace_block(&poster->state, colors, x, poster->band_y, width, height, poster->width, poster->height, poster->samples);
+    if (!poster->write_float) tonemap_pixels(&poster->tonemap, colors, pixels, width * height);
+
+    size_t row_bytes = (size_t) poster->width * poster->bytes_per_pixel;
+
+    for (int y = 0; y < height; y++) {
+        u8 *out = poster->band + y * row_bytes + (size_t) x * poster->bytes_per_pixel;
+
+        for (int i = 0; i < width; i++) {
+            int p = y * width + i;
+            if (poster->write_float) {
+                rgbe_encode(colors[p], out + i * 4);
+            } else {
+                out[i * 3 + 0] = (u8) (pixels[p] >> 16);
+                out[i * 3 + 1] = (u8) (pixels[p] >> 8);
+                out[i * 3 + 2] = (u8) pixels[p];
+            }
+        }
+    }
+}
+
+void poster_thread (void *param) {
+    Poster *poster = param;
+
+    int tile_pixels = poster->tile_size * poster->tile_size;
+    Color *colors = malloc(tile_pixels * sizeof(Color));
+    u32 *pixels = malloc(tile_pixels * sizeof(u32));
+
+    for (;;) {
+        mutex_lock(&poster->lock);
+        int t = poster->next_tile++;
+        mutex_unlock(&poster->lock);
+
+        if (t >= poster->tiles_in_band) break;
+        render_poster_tile(poster, t, colors, pixels);
+    }
+
+    free(colors);
+    free(pixels);
+}
+
+int main (int argc, char **argv) {
+    Render_State state = DEFAULT_RENDER_STATE;
+    const char *output = "poster.ppm";
+    int width = 1280;
+    int height = 720;
+    int samples = 1;
+    int tile_size = 256;
+    int threads = cpu_count();
+
+    float exposure = 0.0f;
+    Tonemap_Curve curve = TONEMAP_CLAMP;
+    float gamma = 1.0f;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if      (strcmp(argv[i], "-o") == 0) output = argv[i + 1];
+        else if (strcmp(argv[i], "-w") == 0) width = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-h") == 0) height = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-s") == 0) samples = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-f") == 0) state.fast_math = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-t") == 0) tile_size = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-j") == 0) threads = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-e") == 0) exposure = (float) atof(argv[i + 1]);
+        else if (strcmp(argv[i], "-c") == 0 && strcmp(argv[i + 1], "clamp") == 0) curve = TONEMAP_CLAMP;
+        else if (strcmp(argv[i], "-c") == 0 && strcmp(argv[i + 1], "reinhard") == 0) curve = TONEMAP_REINHARD;
+        else if (strcmp(argv[i], "-g") == 0) gamma = strcmp(argv[i + 1], "srgb") == 0 ? 0.0f : (float) atof(argv[i + 1]);
+        else if (strcmp(argv[i], "-a") == 0) state.light_size = (float) atof(argv[i + 1]);
+        else if (strcmp(argv[i], "-S") == 0 && sampler_from_name(argv[i + 1]) >= 0) state.sampler = sampler_from_name(argv[i + 1]);
+        else {
+            fprintf(stderr, "unknown option %s %s\n", argv[i], argv[i + 1]);
+            return 1;
+        }
+    }
+
+    if (width <= 0 || height <= 0 || samples <= 0 || tile_size <= 0 || gamma < 0.0f) {
+        fprintf(stderr, "width, height, samples, tile size and gamma have to be positive\n");
+        return 1;
+    }
+    if (threads < 1) threads = 1;
+
+    Poster poster = {
+        .state = state,
+        .width = width,
+        .height = height,
+        .samples = samples,
+        .tile_size = tile_size,
+    };
+
+    size_t output_length = strlen(output);
+    poster.write_float = output_length >= 4 && strcmp(output + output_length - 4, ".hdr") == 0;
+    poster.bytes_per_pixel = poster.write_float ? 4 : 3;
+    poster.state.hdr = poster.write_float;
+    tonemap_init(&poster.tonemap, exposure, curve, gamma);
+
+    char header[128];
+    if (poster.write_float) {
+        sprintf(header, "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y %d +X %d\n", height, width);
+    } else {
+        sprintf(header, "P6\n%d %d\n255\n", width, height);
+    }
+
+    size_t row_bytes = (size_t) width * poster.bytes_per_pixel;
+    u64 file_size = strlen(header) + (u64) row_bytes * height;
+
+    Mapped_File file;
+    if (!mapped_file_create(&file, output, header, file_size)) {
+        fprintf(stderr, "couldn't make %s\n", output);
+        return 1;
+    }
+
+    setup_scene(&poster.state);
+    mutex_init(&poster.lock);
+
+    Thread *pool = malloc(threads * sizeof(Thread));
+    int band_count = (height + tile_size - 1) / tile_size;
+    bool ok = true;
+
+    for (int b = 0; b < band_count && ok; b++) {
+        poster.band_y = b * tile_size;
+        poster.band_height = height - poster.band_y < tile_size ? height - poster.band_y : tile_size;
+        poster.tiles_in_band = (width + tile_size - 1) / tile_size;
+        poster.next_tile = 0;
+
+        u64 offset = strlen(header) + (u64) row_bytes * poster.band_y;
+        if (!mapped_file_map(&file, offset, row_bytes * poster.band_height)) {
+            fprintf(stderr, "couldn't map band %d of %s\n", b, output);
+            ok = false;
+            break;
+        }
+        poster.band = file.data;
+
+        for (int i = 0; i < threads; i++) pool[i] = thread_start(poster_thread, &poster);
+        for (int i = 0; i < threads; i++) thread_join(pool[i]);
+
+        // the band is done, once it's in the file it can go from memory
+        if (!mapped_file_unmap(&file)) {
+            fprintf(stderr, "\ncouldn't write band %d of %s\n", b, output);
+            ok = false;
+            break;
+        }
+
+        fprintf(stderr, "\rband %d of %d", b + 1, band_count);
+    }
+    fprintf(stderr, "\n");
+
+    if (!mapped_file_close(&file)) ok = false;
+    if (!ok) fprintf(stderr, "couldn't write %s\n", output);
+
+    mutex_free(&poster.lock);
+    free(pool);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+// puts the image on the screen from its own thread so the tracer never has to
+// wait for the window and the window never has to wait for the tracer.
+//
+// the tracer draws into the back buffer and swaps it with the front buffer
+// when it finishes some rows. the presenter thread only ever reads the front
+// buffer and draws it whenever global_redraw gets set (a swap or WM_PAINT).
+// the lock is only for swapping, if the presenter is drawing right then the
+// tracer doesn't wait, it keeps going and swaps after the next rows
+
+typedef struct Presenter {
+    HWND window;
+    Win32_Offscreen_Buffer *front;
+    Win32_Offscreen_Buffer *back;
+    CRITICAL_SECTION lock;
+    HANDLE thread;
+
+    // rows of the back buffer the tracer wrote since the last swap
+    int dirty_y0;
+    int dirty_y1;
+} Presenter;
+
+DWORD WINAPI presenter_thread (LPVOID param) {
+    Presenter *presenter = param;
+    HDC device_context = GetDC(presenter->window);
+
+    while (global_running) {
+        // also redraws now and then without being told to, in case it missed one
+        WaitForSingleObject(global_redraw, 100);
+
+        Win32_Window_Dimension dimension = win32_get_window_dimension(presenter->window);
+
+        EnterCriticalSection(&presenter->lock);
+        win32_display_buffer_in_window(
+            device_context,
+            dimension.width,
+            dimension.height,
+            presenter->front,
+            0, 0,
+            dimension.width, dimension.height
+        );
+        LeaveCriticalSection(&presenter->lock);
+    }
+
+    ReleaseDC(presenter->window, device_context);
+    return 0;
+}
+
+// both buffers have to be the same size
+void presenter_start (
+    Presenter *presenter, HWND window,
+    Win32_Offscreen_Buffer *front, Win32_Offscreen_Buffer *back
+) {
+    presenter->window = window;
+    presenter->front = front;
+    presenter->back = back;
+    presenter->dirty_y0 = back->height;
+    presenter->dirty_y1 = 0;
+
+    InitializeCriticalSection(&presenter->lock);
+    presenter->thread = CreateThread(0, 0, presenter_thread, presenter, 0, 0);
+}
+
+// call once global_running is false
+void presenter_stop (Presenter *presenter) {
+    SetEvent(global_redraw);
+    WaitForSingleObject(presenter->thread, INFINITE);
+    CloseHandle(presenter->thread);
+    DeleteCriticalSection(&presenter->lock);
+}
+
+// the tracer calls this when it's done writing rows y0 to y1 - 1 of the back
+// buffer. if wait is false and the presenter is busy it doesn't swap, the
+// rows get shown after a later call
+void presenter_rows_done (Presenter *presenter, int y0, int y1, bool wait) {
+    if (y0 < presenter->dirty_y0) presenter->dirty_y0 = y0;
+    if (y1 > presenter->dirty_y1) presenter->dirty_y1 = y1;
+
+    if (wait) EnterCriticalSection(&presenter->lock);
+    else if (!TryEnterCriticalSection(&presenter->lock)) return;
+
+    Win32_Offscreen_Buffer *front = presenter->back;
+    presenter->back = presenter->front;
+    presenter->front = front;
+
+    LeaveCriticalSection(&presenter->lock);
+    SetEvent(global_redraw);
+
+    // the new back buffer doesn't have the rows since the last swap, copy
+    // them over so the tracer can keep drawing on top of a whole image. the
+    // presenter might be reading the front buffer right now but that's fine
+    // because it's only reading too
+    Win32_Offscreen_Buffer *back = presenter->back;
+    int offset = back->pitch * presenter->dirty_y0;
+    int size = back->pitch * (presenter->dirty_y1 - presenter->dirty_y0);
+    memcpy((u8 *) back->memory + offset, (u8 *) front->memory + offset, size);
+
+    presenter->dirty_y0 = back->height;
+    presenter->dirty_y1 = 0;
+}
@@ -0,0 +1,463 @@
+// rendering for long, high sample renders that can be stopped and carried on
+// later. the image is done one sample at a time: each tile adds one more
+// sample to every one of its pixels per pass, and the sums, how many samples
+// each pixel has and how many passes each tile has had all get saved to a
+// checkpoint file every so often. starting again with resume picks up from
+// that file and comes out exactly the same as if it was never stopped,
+// because every tile always adds its samples in the same order.
+//
+// the checkpoints are saved by their own thread. it copies one tile at a
+// time while holding the lock, which is the same lock the render threads
+// take to add a finished pass, so every tile in the file is whole, and the
+// render threads only ever wait for one tile's worth of copying
+//
+// with numa set the render threads are kept on cpus spread over the numa
+// nodes (see Cpu_Layout in threads.c) and each node gets a band of the
+// image. a thread does the tiles in its node's band first and only helps
+// with the others once those are done, so the part of sums a thread writes
+// to is in its own node's memory. that goes for resuming too, a tile is
+// copied in from the checkpoint by the first thread that works on it and not
+// when the file is read. the scene is read by every ray, so each node also
+// gets its own copy of the render state, made by the first of its threads
+// to start, and its threads trace from that
+//
+// sums and sample_counts are kept a tile at a time instead of a row at a
+// time: each tile's pixels are together, row after row inside the tile.
+// adding a pass to a tile is one run through memory instead of a piece of
+// tile_size different rows, and the same goes for copying a tile out for a
+// checkpoint. the checkpoint file and the colors that come out at the end
+// are in rows like everywhere else
+//
+// this is the only frame kept in tiles because it's the only one that gets
+// added to over and over. the others are written once, a row or a block of
+// rows at a time, and then read in rows by the tone mapping and the
+// encoder, the window and poster's mapped file. the denoiser copies the
+// colors into its own padded planes anyway. tiling those would only add a
+// copy
+
+#define CHECKPOINT_MAGIC "RTCKPT03"
+#define PROGRESSIVE_TILE_SIZE 32
+
+// the settings a checkpoint was made with, resuming only works with the same
+typedef struct Checkpoint_Header {
+    char magic[8];
+    s32 width;
+    s32 height;
+    s32 samples;
+    s32 tile_size;
+    s32 fast_math;
+    s32 hdr;
+    s32 sampler;
+    float light_size;
+} Checkpoint_Header;
+
+typedef struct Progressive {
+    const Render_State *state;
+    Checkpoint_Header settings;
+    int tiles_x;
+    int tile_count;
+    int passes; // samples * samples
+
+    Color *sums;        // per pixel, all its samples added up, in tiles
+    u32 *sample_counts; // per pixel, in tiles
+    u32 *tile_passes;   // per tile, how many passes are in sums
+    bool *tile_busy;
+    int passes_left;    // over all tiles
+
+    // when resuming, the checkpoint's sums and counts in rows, and which
+    // tiles have been copied from them into sums yet (see progressive_resume_tile)
+    float *resume_sums;
+    u32 *resume_counts;
+    bool *tile_resumed;
+
+    Render_State **node_states; // with numa, each node's copy of state
+
+    Mutex lock;
+    Condition changed;
+
+    const char *checkpoint_path;
+    int checkpoint_seconds;
+    bool finished;
+} Progressive;
+
+void progressive_tile_rect (Progressive *p, int t, int *x, int *y, int *width, int *height) {
+    int size = p->settings.tile_size;
+    *x = (t % p->tiles_x) * size;
+    *y = (t / p->tiles_x) * size;
+    *width = *x + size > p->settings.width ? p->settings.width - *x : size;
+    *height = *y + size > p->settings.height ? p->settings.height - *y : size;
+}
+
+// where tile t starts in sums and sample_counts. every tile gets room for
+// tile_size * tile_size pixels even if it's cut off at the edge
+size_t progressive_tile_start (Progressive *p, int t) {
+    return (size_t) t * p->settings.tile_size * p->settings.tile_size;
+}
+
+// checkpoint files
+
+bool checkpoint_save (Progressive *p, float *pixel_sums, u32 *counts, u32 *tile_passes) {
+    int width = p->settings.width;
+
+    // copy it out a tile at a time so the render threads barely notice
+    for (int t = 0; t < p->tile_count; t++) {
+        int x0, y0, tile_width, tile_height;
+        progressive_tile_rect(p, t, &x0, &y0, &tile_width, &tile_height);
+
+        Color *sums = p->sums + progressive_tile_start(p, t);
+        u32 *sample_counts = p->sample_counts + progressive_tile_start(p, t);
+
+        mutex_lock(&p->lock);
+        if (p->resume_sums && !p->tile_resumed[t]) {
+            // nobody has gotten to it yet, it's still what was loaded
+            for (int y = 0; y < tile_height; y++) {
+                size_t i = (size_t) (y0 + y) * width + x0;
+                memcpy(pixel_sums + i * 3, p->resume_sums + i * 3, tile_width * sizeof(float) * 3);
+                memcpy(counts + i, p->resume_counts + i, tile_width * sizeof(u32));
+            }
+        } else {
+            for (int y = 0; y < tile_height; y++) {
+                for (int x = 0; x < tile_width; x++) {
+                    size_t i = (size_t) (y0 + y) * width + x0 + x;
+                    Color sum = sums[y * tile_width + x];
+                    pixel_sums[i * 3 + 0] = sum.r;
+                    pixel_sums[i * 3 + 1] = sum.g;
+                    pixel_sums[i * 3 + 2] = sum.b;
+                    counts[i] = sample_counts[y * tile_width + x];
+                }
+            }
+        }
+        tile_passes[t] = p->tile_passes[t];
+        mutex_unlock(&p->lock);
+    }
+
+    // written next to it first so there's always a whole checkpoint on disk
+    char temp_path[1024];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", p->checkpoint_path);
+
+    FILE *file = fopen(temp_path, "wb");
+    if (!file) return false;
+
+    size_t pixel_count = (size_t) width * p->settings.height;
+    fwrite(&p->settings, sizeof(p->settings), 1, file);
+    fwrite(pixel_sums, sizeof(float) * 3, pixel_count, file);
+    fwrite(counts, sizeof(u32), pixel_count, file);
+    fwrite(tile_passes, sizeof(u32), p->tile_count, file);
+
+    bool ok = !ferror(file);
+    if (fclose(file) != 0) ok = false;
+    if (!ok) return false;
+
+#ifdef _WIN32
+    return MoveFileExA(temp_path, p->checkpoint_path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(temp_path, p->checkpoint_path) == 0;
+#endif
+}
+
+// reads the checkpoint into resume_sums and resume_counts, the tiles get
+// copied out of those later by progressive_resume_tile
+bool checkpoint_load (Progressive *p) {
+    FILE *file = fopen(p->checkpoint_path, "rb");
+    if (!file) return false;
+
+    Checkpoint_Header header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+        memcmp(&header, &p->settings, sizeof(header)) == 0;
+
+    size_t pixel_count = (size_t) p->settings.width * p->settings.height;
+    p->resume_sums = malloc(pixel_count * sizeof(float) * 3);
+    p->resume_counts = malloc(pixel_count * sizeof(u32));
+    p->tile_resumed = calloc(p->tile_count, sizeof(bool));
+
+    ok = ok &&
+        fread(p->resume_sums, sizeof(float) * 3, pixel_count, file) == pixel_count &&
+        fread(p->resume_counts, sizeof(u32), pixel_count, file) == pixel_count &&
+        fread(p->tile_passes, sizeof(u32), p->tile_count, file) == (size_t) p->tile_count;
+
+    if (ok) {
+        p->passes_left = 0;
+        for (int t = 0; t < p->tile_count; t++) {
+            if (p->tile_passes[t] > (u32) p->passes) ok = false;
+            else p->passes_left += p->passes - p->tile_passes[t];
+        }
+    }
+
+    fclose(file);
+    return ok;
+}
+
+// copies tile t from the loaded checkpoint into sums and sample_counts. the
+// caller has to have the tile to itself, and this is the first write to
+// that part of sums so its memory goes on the caller's node
+void progressive_resume_tile (Progressive *p, int t) {
+    int x0, y0, tile_width, tile_height;
+    progressive_tile_rect(p, t, &x0, &y0, &tile_width, &tile_height);
+
+    Color *sums = p->sums + progressive_tile_start(p, t);
+    u32 *sample_counts = p->sample_counts + progressive_tile_start(p, t);
+
+    for (int y = 0; y < tile_height; y++) {
+        for (int x = 0; x < tile_width; x++) {
+            size_t i = (size_t) (y0 + y) * p->settings.width + x0 + x;
+            Color *sum = &sums[y * tile_width + x];
+            *sum = (Color) {0};
+            sum->r = p->resume_sums[i * 3 + 0];
+            sum->g = p->resume_sums[i * 3 + 1];
+            sum->b = p->resume_sums[i * 3 + 2];
+            sample_counts[y * tile_width + x] = p->resume_counts[i];
+        }
+    }
+}
+
+void checkpoint_thread (void *param) {
+    Progressive *p = param;
+
+    size_t pixel_count = (size_t) p->settings.width * p->settings.height;
+    float *pixel_sums = malloc(pixel_count * sizeof(float) * 3);
+    u32 *counts = malloc(pixel_count * sizeof(u32));
+    u32 *tile_passes = malloc(p->tile_count * sizeof(u32));
+
+    int waited_ms = 0;
+    for (;;) {
+        mutex_lock(&p->lock);
+        bool finished = p->finished;
+        int passes_left = p->passes_left;
+        mutex_unlock(&p->lock);
+        if (finished) break;
+
+        // short sleeps so it notices when the render is done
+        sleep_ms(100);
+        waited_ms += 100;
+        if (waited_ms < p->checkpoint_seconds * 1000) continue;
+        waited_ms = 0;
+
+        if (checkpoint_save(p, pixel_sums, counts, tile_passes)) {
+            int total = p->tile_count * p->passes;
+            fprintf(stderr, "checkpoint: %d of %d tile passes\n", total - passes_left, total);
+        } else {
+            fprintf(stderr, "checkpoint: couldn't write %s\n", p->checkpoint_path);
+        }
+    }
+
+    free(pixel_sums);
+    free(counts);
+    free(tile_passes);
+}
+
+// rendering
+
+// one render thread and the tiles it does first
+typedef struct Progressive_Worker {
+    Progressive *p;
+    int node;      // -1 without numa
+    int first_tile;
+    int last_tile; // one past
+} Progressive_Worker;
+
+// the tile with the fewest passes that nobody is working on, so the whole
+// image gets better at the same rate. -1 if there isn't one
+int progressive_pick_tile_in (Progressive *p, int first, int last) {
+    int best = -1;
+    for (int t = first; t < last; t++) {
+        if (p->tile_busy[t] || p->tile_passes[t] >= (u32) p->passes) continue;
+        if (best < 0 || p->tile_passes[t] < p->tile_passes[best]) best = t;
+    }
+    return best;
+}
+
+int progressive_pick_tile (Progressive_Worker *worker) {
+    int t = progressive_pick_tile_in(worker->p, worker->first_tile, worker->last_tile);
+    if (t < 0) t = progressive_pick_tile_in(worker->p, 0, worker->p->tile_count);
+    return t;
+}
+
+void progressive_thread (void *param) {
+    Progressive_Worker *worker = param;
+    Progressive *p = worker->p;
+
+    int size = p->settings.tile_size;
+    Color *pass = malloc(size * size * sizeof(Color));
+
+    // this thread is already on its node, so the copy it makes and writes
+    // goes in that node's memory
+    const Render_State *state = p->state;
+    mutex_lock(&p->lock);
+    if (worker->node >= 0) {
+        if (!p->node_states[worker->node]) {
+            Render_State *copy = malloc(sizeof(Render_State));
+            *copy = *p->state;
+            p->node_states[worker->node] = copy;
+        }
+        state = p->node_states[worker->node];
+    }
+
+    while (p->passes_left > 0) {
+        int t = progressive_pick_tile(worker);
+        if (t < 0) {
+            // everything that's left is being worked on
+            condition_wait(&p->changed, &p->lock);
+            continue;
+        }
+
+        p->tile_busy[t] = true;
+        int sample = p->tile_passes[t];
+        bool resume = p->resume_sums && !p->tile_resumed[t];
+        mutex_unlock(&p->lock);
+
+        if (resume) progressive_resume_tile(p, t);
+
+        int x0, y0, width, height;
+        progressive_tile_rect(p, t, &x0, &y0, &width, &height);
+
+        for (int i = 0; i < width * height; i++) pass[i] = (Color) {0};
+        trace_block_samples(
+            state, pass, x0, y0, width, height,
+            p->settings.width, p->settings.height, p->settings.samples, sample, 1
+        );
+
+        // pass is laid out the same as the tile in sums
+        Color *sums = p->sums + progressive_tile_start(p, t);
+        u32 *sample_counts = p->sample_counts + progressive_tile_start(p, t);
+
+        mutex_lock(&p->lock);
+        for (int i = 0; i < width * height; i++) {
+            sums[i] = color_sum(sums[i], pass[i]);
+            sample_counts[i]++;
+        }
+        p->tile_passes[t]++;
+        p->tile_busy[t] = false;
+        if (resume) p->tile_resumed[t] = true;
+        p->passes_left--;
+        condition_wake_all(&p->changed);
+    }
+    mutex_unlock(&p->lock);
+
+    free(pass);
+}
+
+// renders state at width x height with samples * samples samples per pixel on
+// threads threads, saving to checkpoint_path every checkpoint_seconds. with
+// resume it starts from what's in checkpoint_path. numa places the threads
+// (see the top). returns the colors (malloced), or NULL if resuming didn't
+// work. the checkpoint gets deleted once the image is done
+Color *render_progressive (
+    const Render_State *state, int width, int height, int samples, int tile_size, int threads,
+    const char *checkpoint_path, int checkpoint_seconds, bool resume, bool numa
+) {
+    Progressive p = {0};
+    p.state = state;
+    memcpy(p.settings.magic, CHECKPOINT_MAGIC, 8);
+    p.settings.width = width;
+    p.settings.height = height;
+    p.settings.samples = samples;
+    p.settings.tile_size = tile_size;
+    p.settings.fast_math = state->fast_math;
+    p.settings.hdr = state->hdr;
+    p.settings.sampler = state->sampler;
+    p.settings.light_size = state->light_size;
+
+    p.tiles_x = (width + tile_size - 1) / tile_size;
+    p.tile_count = p.tiles_x * ((height + tile_size - 1) / tile_size);
+    p.passes = samples * samples;
+    p.passes_left = p.tile_count * p.passes;
+
+    size_t tiled_count = progressive_tile_start(&p, p.tile_count);
+    p.sums = calloc(tiled_count, sizeof(Color));
+    p.sample_counts = calloc(tiled_count, sizeof(u32));
+    p.tile_passes = calloc(p.tile_count, sizeof(u32));
+    p.tile_busy = calloc(p.tile_count, sizeof(bool));
+
+    p.checkpoint_path = checkpoint_path;
+    p.checkpoint_seconds = checkpoint_seconds;
+
+    if (resume && !checkpoint_load(&p)) {
+        fprintf(stderr, "couldn't resume from %s, it's missing or from different settings\n", checkpoint_path);
+        free(p.sums);
+        free(p.sample_counts);
+        free(p.tile_passes);
+        free(p.tile_busy);
+        free(p.resume_sums);
+        free(p.resume_counts);
+        free(p.tile_resumed);
+        return NULL;
+    }
+
+    mutex_init(&p.lock);
+    condition_init(&p.changed);
+
+    if (threads < 1) threads = 1;
+    Thread *pool = malloc(threads * sizeof(Thread));
+    Progressive_Worker *workers = malloc(threads * sizeof(Progressive_Worker));
+
+    Cpu_Layout *layout = malloc(sizeof(Cpu_Layout));
+    cpu_layout(layout);
+
+    if (numa) p.node_states = calloc(layout->node_count, sizeof(Render_State *));
+
+    for (int i = 0; i < threads; i++) {
+        workers[i] = (Progressive_Worker) { .p = &p, .node = -1, .first_tile = 0, .last_tile = p.tile_count };
+
+        if (numa) {
+            int node;
+            int cpu = cpu_layout_place(layout, i, &node);
+            workers[i].node = node;
+            workers[i].first_tile = p.tile_count * node / layout->node_count;
+            workers[i].last_tile = p.tile_count * (node + 1) / layout->node_count;
+            pool[i] = thread_start_on(progressive_thread, &workers[i], cpu);
+        } else {
+            pool[i] = thread_start(progressive_thread, &workers[i]);
+        }
+    }
+
+    Thread checkpointer = thread_start(checkpoint_thread, &p);
+
+    for (int i = 0; i < threads; i++) thread_join(pool[i]);
+
+    mutex_lock(&p.lock);
+    p.finished = true;
+    mutex_unlock(&p.lock);
+    thread_join(checkpointer);
+
+    remove(checkpoint_path);
+
+    // back into rows, dividing by the sample counts on the way
+    Color *colors = malloc((size_t) width * height * sizeof(Color));
+    for (int t = 0; t < p.tile_count; t++) {
+        int x0, y0, tile_width, tile_height;
+        progressive_tile_rect(&p, t, &x0, &y0, &tile_width, &tile_height);
+
+        // tiles that were already done in the checkpoint never got picked
+        if (p.resume_sums && !p.tile_resumed[t]) progressive_resume_tile(&p, t);
+
+        Color *sums = p.sums + progressive_tile_start(&p, t);
+        u32 *sample_counts = p.sample_counts + progressive_tile_start(&p, t);
+
+        for (int y = 0; y < tile_height; y++) {
+            Color *row = colors + (size_t) (y0 + y) * width + x0;
+            for (int x = 0; x < tile_width; x++) {
+                int i = y * tile_width + x;
+                row[x] = color_scale(sums[i], 1.0f / (float) sample_counts[i]);
+            }
+        }
+    }
+
+    if (numa) {
+        for (int n = 0; n < layout->node_count; n++) free(p.node_states[n]);
+        free(p.node_states);
+    }
+
+    mutex_free(&p.lock);
+    condition_free(&p.changed);
+    free(pool);
+    free(workers);
+    free(layout);
+    free(p.sums);
+    free(p.sample_counts);
+    free(p.tile_passes);
+    free(p.tile_busy);
+    free(p.resume_sums);
+    free(p.resume_counts);
+    free(p.tile_resumed);
+    return colors;
+}
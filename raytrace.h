@@ -0,0 +1,109 @@
+// the tracer as a library, for putting it inside other programs. build
+// library.c into a static library (make builds build/<profile>/libraytrace.a,
+// "build lib" makes raytrace.lib on windows) and include this.
+//
+// everything goes through a context, which has its own scene, camera and
+// settings. contexts don't share anything so two threads can each render
+// with their own at the same time. one context shouldn't be used from two
+// threads at once, except for raytrace_cancel which is meant for that.
+//
+//     Raytrace_Context *context = raytrace_create();
+//     raytrace_default_scene(context, 0.0f);
+//
+//     Raytrace_Settings settings = raytrace_default_settings(1280, 720);
+//     float *rgb = malloc(1280 * 720 * 3 * sizeof(float));
+//     raytrace_render(context, &settings, NULL, rgb, on_tile, user);
+//
+//     raytrace_destroy(context);
+//
+// see embed.c for a whole program
+
+#ifndef RAYTRACE_H
+#define RAYTRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct Raytrace_Context Raytrace_Context;
+
+typedef enum Raytrace_Result {
+    RAYTRACE_OK,
+    RAYTRACE_CANCELLED, // raytrace_cancel got called, the buffer is only partly filled in
+    RAYTRACE_BAD_SETTINGS
+} Raytrace_Result;
+
+typedef enum Raytrace_Sampler {
+    RAYTRACE_SAMPLER_GRID,
+    RAYTRACE_SAMPLER_JITTER,
+    RAYTRACE_SAMPLER_HALTON,
+    RAYTRACE_SAMPLER_SOBOL,
+    RAYTRACE_SAMPLER_BLUE
+} Raytrace_Sampler;
+
+typedef struct Raytrace_Settings {
+    int width;      // of the whole image, a region is part of this
+    int height;
+    int samples;    // rays per side of each pixel, so samples*samples rays
+    int threads;    // 0 is one per cpu
+    int tile_size;  // the callback gets called once per tile
+    int fast_math;  // 0, 1 or 2, see FAST_MATH in raytrace_math.c
+    int hdr;        // 1 lets light go past 1 instead of clamping it
+    Raytrace_Sampler sampler;
+} Raytrace_Settings;
+
+// part of the image, in pixels
+typedef struct Raytrace_Region {
+    int x;
+    int y;
+    int width;
+    int height;
+} Raytrace_Region;
+
+// called on one of the render threads every time a tile is finished and in
+// the buffer. x, y, width and height are the tile in image pixels. it gets
+// called from several threads at once, so it has to be safe for that
+typedef void (*Raytrace_Tile_Callback) (
+    void *user, int x, int y, int width, int height, int tiles_done, int tile_count
+);
+
+Raytrace_Context *raytrace_create (void);
+void raytrace_destroy (Raytrace_Context *context);
+
+// the built in scene, with the lights light_size across (0 is point lights)
+void raytrace_default_scene (Raytrace_Context *context, float light_size);
+
+// a scene made by another build with the same struct layout, the blob format
+// from scene_pack in render.c. 0 if it doesn't match
+int raytrace_load_scene (Raytrace_Context *context, const void *blob, unsigned int size);
+
+// pos is where it is, it looks along forward, left and up are the directions
+// the image goes across and up in, zoom is how wide it sees (default 1.2)
+void raytrace_set_camera (
+    Raytrace_Context *context,
+    const float pos[3], const float forward[3], const float left[3], const float up[3],
+    float zoom
+);
+
+Raytrace_Settings raytrace_default_settings (int width, int height);
+
+// renders region (the whole image if it's NULL) into rgb, which is three
+// floats per pixel for region->width * region->height pixels, row after row.
+// it doesn't come back until it's done or cancelled
+Raytrace_Result raytrace_render (
+    Raytrace_Context *context, const Raytrace_Settings *settings,
+    const Raytrace_Region *region, float *rgb,
+    Raytrace_Tile_Callback callback, void *user
+);
+
+// stops the render the context is doing, from any thread. tiles that are
+// already being traced finish but no new ones start. if the context isn't
+// rendering right now it stops the next render instead, before it traces
+// anything (so cancelling just before raytrace_render starts isn't lost)
+void raytrace_cancel (Raytrace_Context *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
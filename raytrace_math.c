@@ -1,19 +1,57 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <xmmintrin.h>
+
+#ifdef _WIN32
 #include <windows.h>
+#endif
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+typedef int8_t  s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
 
+typedef float r32;
+typedef double r64;
+
+#ifdef _WIN32
 #define DEBUG_PRINT(...) { \
     char _debug_str[256]; \
     sprintf(_debug_str, __VA_ARGS__); \
     OutputDebugString(_debug_str); \
 }
+#else
+#define DEBUG_PRINT(...) fprintf(stderr, __VA_ARGS__)
+#endif
 
 #define ARRAY_LEN(x) sizeof((x))/sizeof((x)[0])
 
+#ifdef _MSC_VER
+#define ALIGN16 __declspec(align(16))
+#define FORCE_INLINE static __forceinline
+#else
+#define ALIGN16 __attribute__((aligned(16)))
+#define FORCE_INLINE static inline __attribute__((always_inline))
+#endif
+
 #define EPSILON 0.0004
 
 // types
 
+// build with RAYTRACE_SIMD defined to get the sse vector/color functions from
+// raytrace_simd.c instead of the plain ones below
+#ifdef RAYTRACE_SIMD
+#include "raytrace_simd.c"
+#else
 typedef struct Vector3 {
     float x;
     float y;
@@ -25,6 +63,7 @@ typedef struct Color {
     float g;
     float b;
 } Color;
+#endif
 
 typedef struct Material {
     Color color;
@@ -63,9 +102,21 @@ typedef struct Ray {
     Vector3 dir;
 } Ray;
 
+// point lights give hard shadows. sphere and rect lights are area lights,
+// the shading still treats them as a point at pos but the shadows get softer
+// the bigger they are (see light_visibility)
+typedef enum Light_Shape {
+    LIGHT_POINT, LIGHT_SPHERE, LIGHT_RECT
+} Light_Shape;
+
 typedef struct Light {
     Vector3 pos;
     Color color;
+
+    Light_Shape shape;
+    float radius;   // LIGHT_SPHERE
+    Vector3 edge_u; // LIGHT_RECT, the two sides, it's centered on pos
+    Vector3 edge_v;
 } Light;
 
 typedef enum Object_Type {
@@ -83,10 +134,64 @@ typedef struct Object {
     Material material;
 } Object;
 
-// global scene variables
+// the camera sits at pos looking along forward, left and up are the
+// directions the picture goes across and up in. zoom is how wide the view
+// is, bigger is wider
+typedef struct Camera {
+    Vector3 pos;
+    Vector3 forward;
+    Vector3 left;
+    Vector3 up;
+    float zoom;
+} Camera;
+
+#define DEFAULT_CAMERA { \
+    .pos = {0.0f, 0.0f, 1.0f}, \
+    .forward = {0.0f, 0.0f, 1.0f}, \
+    .left = {1.0f, 0.0f, 0.0f}, \
+    .up = {0.0f, 1.0f, 0.0f}, \
+    .zoom = 1.2f \
+}
 
-Object scene[6];
-Light lights[3];
+// where in a pixel its rays go, see sampler.c
+typedef enum Sampler {
+    SAMPLER_GRID,
+    SAMPLER_JITTER,
+    SAMPLER_HALTON,
+    SAMPLER_SOBOL,
+    SAMPLER_BLUE,
+    SAMPLER_COUNT
+} Sampler;
+
+typedef struct Ray_Footprint Ray_Footprint;
+
+#define SCENE_OBJECTS 6
+#define SCENE_LIGHTS 3
+
+// the scene and the settings, everything the tracer reads that isn't a
+// function argument. all the tracing functions take one of these instead of
+// there being globals, so two renders can go at once in one process as long
+// as each has its own. the threads of one render share it, nothing changes
+// it while they trace
+typedef struct Render_State {
+    Object scene[SCENE_OBJECTS];
+    Light lights[SCENE_LIGHTS];
+    Camera camera;
+    int fast_math;    // see FAST_MATH
+    bool hdr;         // see color_add_light
+    Sampler sampler;
+    float light_size; // see setup_scene
+
+    // when this isn't NULL intersect_scene marks every ray it looks along
+    // into it, see temporal.c
+    Ray_Footprint *footprint;
+} Render_State;
+
+#define DEFAULT_RENDER_STATE { \
+    .camera = DEFAULT_CAMERA, \
+    .fast_math = FAST_MATH, \
+    .sampler = SAMPLER_GRID \
+}
 
 // math functions
 
@@ -106,6 +211,117 @@ bool fequal (float a, float b) {
     return false;
 }
 
+// hashing and low discrepancy bits, for sampler.c and the area lights
+
+// mixes the bits up well enough that nearby inputs give unrelated outputs
+u32 hash_u32 (u32 x) {
+    x ^= x >> 16;
+    x *= 0x7FEB352Du;
+    x ^= x >> 15;
+    x *= 0x846CA68Bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// [0, 1) from the top 24 bits
+float u32_to_unit (u32 v) {
+    return (float) (v >> 8) * (1.0f / 16777216.0f);
+}
+
+u32 reverse_bits (u32 v) {
+    v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+    v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+    v = ((v >> 4) & 0x0F0F0F0Fu) | ((v & 0x0F0F0F0Fu) << 4);
+    v = ((v >> 8) & 0x00FF00FFu) | ((v & 0x00FF00FFu) << 8);
+    return (v >> 16) | (v << 16);
+}
+
+// second sobol dimension, the first one is just reverse_bits
+u32 sobol_2 (u32 n) {
+    u32 result = 0;
+    for (u32 v = 1u << 31; n; n >>= 1, v ^= v >> 1) {
+        if (n & 1) result ^= v;
+    }
+    return result;
+}
+
+// fast math
+
+// FAST_MATH picks how pow and vector normalizing get done while shading:
+//   0 - exact, uses the c library
+//   1 - cheap pow, off by up to ~3% at shinyness 30
+//   2 - pow with more polynomial terms, off by ~0.07%
+// anything above 0 normalizes with rsqrtss and a newton step instead of a
+// sqrt and a divide. FAST_MATH is only the default, it's Render_State's
+// fast_math that counts so the benchmark can compare them
+#ifndef FAST_MATH
+#define FAST_MATH 0
+#endif
+
+typedef union Float_Bits {
+    float f;
+    u32 i;
+} Float_Bits;
+
+// splits x into exponent and mantissa using the float bits and then fits a
+// polynomial to log2 of the mantissa, x has to be positive
+float fast_log2 (float x, int fast_math) {
+    Float_Bits bits = { x };
+    float exponent = (float) (int) ((bits.i >> 23) & 255) - 127.0f;
+
+    bits.i = (bits.i & 0x007FFFFF) | 0x3F800000;
+    float t = bits.f - 1.0f; // mantissa - 1, in [0, 1)
+
+    float p;
+    if (fast_math > 1) {
+        p = 3.1807274e-05f + t*(1.4412689f + t*(-0.70571098f + t*(0.40873417f +
+            t*(-0.18773214f + t*0.043431324f))));
+    } else {
+        p = 0.001332797f + t*(1.4134955f + t*(-0.56776651f + t*0.15391848f));
+    }
+
+    return exponent + p;
+}
+
+// the opposite, the whole part of x goes straight into the exponent bits and
+// the fractional part gets a polynomial
+float fast_exp2 (float x, int fast_math) {
+    if (x < -126.0f) return 0.0f;
+    if (x > 127.0f) x = 127.0f;
+
+    float whole = floorf(x);
+    float t = x - whole;
+
+    float p;
+    if (fast_math > 1) {
+        p = 0.99999983f + t*(0.69315473f + t*(0.24014653f + t*(0.055835902f +
+            t*(0.0089872972f + t*0.001875373f))));
+    } else {
+        p = 0.9998639f + t*(0.6961709f + t*(0.22586994f + t*0.077822868f));
+    }
+
+    Float_Bits bits;
+    bits.i = (u32) ((int) whole + 127) << 23;
+    return p * bits.f;
+}
+
+// rsqrtss on its own is only about 12 bits which is not enough for the ray
+// directions (rays start hitting the surface they came from), one newton
+// step gets it close to full float precision
+float fast_rsqrt (float x) {
+    float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+    return y * (1.5f - 0.5f * x * y * y);
+}
+
+// this and shade_normalize are what the rest of the code calls, they pick
+// based on fast_math
+
+float shade_pow (const Render_State *state, float a, float b) {
+    if (!state->fast_math) return powf(a, b);
+    if (a <= 0.0f) return 0.0f;
+    return fast_exp2(b * fast_log2(a, state->fast_math), state->fast_math);
+}
+
 // find solution to quadratic equation with quadratic formula
 // returns number of solutions and puts them in answers[]
 int quadform (float a, float b, float c, float *answers) {
@@ -118,8 +334,9 @@ int quadform (float a, float b, float c, float *answers) {
         return 1;
     }
 
-    float x1 = (-b + sqrt(discriminant)) / 2.0f / a;
-    float x2 = (-b - sqrt(discriminant)) / 2.0f / a;
+    float root = sqrtf(discriminant);
+    float x1 = (-b + root) / 2.0f / a;
+    float x2 = (-b - root) / 2.0f / a;
 
     answers[0] = x1;
     answers[1] = x2;
@@ -145,8 +362,9 @@ int quadform_only_positive (float a, float b, float c, float *answers) {
         }
     }
 
-    float x1 = (-b + sqrt(discriminant)) / 2.0f / a;
-    float x2 = (-b - sqrt(discriminant)) / 2.0f / a;
+    float root = sqrtf(discriminant);
+    float x1 = (-b + root) / 2.0f / a;
+    float x2 = (-b - root) / 2.0f / a;
 
     int index = 0;
 
@@ -163,6 +381,8 @@ int quadform_only_positive (float a, float b, float c, float *answers) {
     return index;
 }
 
+#ifndef RAYTRACE_SIMD
+
 // vector functions
 
 Vector3 vec3_add (Vector3 a, Vector3 b) {
@@ -208,6 +428,12 @@ Color color_add (Color a, Color b) {
     };
 }
 
+// adds without clamping, for when you're adding up light that gets scaled
+// down again later
+Color color_sum (Color a, Color b) {
+    return (Color) {a.r + b.r, a.g + b.g, a.b + b.b};
+}
+
 Color color_mul (Color a, Color b) {
     return (Color) {a.r * b.r, a.g * b.g, a.b * b.b};
 }
@@ -225,27 +451,51 @@ Color color_lerp (Color a, Color b, float alpha) {
     };
 }
 
+#endif
+
+// the sse vec3_normalize always uses rsqrtps and a newton step, the plain
+// one only does that with fast_math
+Vector3 shade_normalize (const Render_State *state, Vector3 a) {
+#ifndef RAYTRACE_SIMD
+    if (state->fast_math) return vec3_mul(a, fast_rsqrt(vec3_dot(a, a)));
+#endif
+    return vec3_normalize(a);
+}
+
+// with hdr off light gets clamped to 1 every time some is added, which is
+// how this has always looked. with it on the light just adds up and the
+// colors that come out are linear and can go past 1, tonemap.c turns them
+// into something a screen can show
+FORCE_INLINE Color color_add_light (const Render_State *state, Color a, Color b) {
+    return state->hdr ? color_sum(a, b) : color_add(a, b);
+}
+
 // checkerboards and different color/material properties depending on location
-Material checkerboard_choose_material (Object object, Vector3 point) {
-    Checkerboard checkerboard = object.checkerboard;
 
+// true if the point is on one of the squares that uses the object's own
+// material, false if it's on a material_2 square
+bool checkerboard_parity (const Render_State *state, Checkerboard checkerboard, Vector3 point) {
     Vector3 v0 = (Vector3) {1.0f, 0.0f, 0.0f};   
-    Vector3 u = vec3_normalize(vec3_cross(checkerboard.plane.normal, v0));
-    Vector3 v = vec3_normalize(vec3_cross(checkerboard.plane.normal, u));
+    Vector3 u = shade_normalize(state, vec3_cross(checkerboard.plane.normal, v0));
+    Vector3 v = shade_normalize(state, vec3_cross(checkerboard.plane.normal, u));
 
     Vector3 ref = vec3_sub(point, checkerboard.plane.pos);
 
     int ui = (int) ceil(vec3_dot(u, ref) / checkerboard.scale);
     int vi = (int) ceil(vec3_dot(v, ref) / checkerboard.scale);
 
-    if ((unsigned)ui % 2 != (unsigned)vi % 2)
+    return (unsigned)ui % 2 != (unsigned)vi % 2;
+}
+
+Material checkerboard_choose_material (const Render_State *state, Object object, Vector3 point) {
+    if (checkerboard_parity(state, object.checkerboard, point))
         return object.material;
     else
-        return checkerboard.material_2;
+        return object.checkerboard.material_2;
 }
 
 // returns an objects material, normally it's always the same except for checkerboards
-Material object_material (Object object, Vector3 point) {
+Material object_material (const Render_State *state, Object object, Vector3 point) {
     Material material;
     switch (object.type) {
         case OBJ_INDENTSPHERE:
@@ -255,35 +505,43 @@ Material object_material (Object object, Vector3 point) {
             break;
         case OBJ_CHECKERBOARD:
             material = checkerboard_choose_material(
-                object, point);
+                state, object, point);
             break;
     }
 
     return material;
 }
 
+// same as object_material but gives back a pointer into the object instead of
+// a copy
+const Material *object_material_ref (const Render_State *state, const Object *object, Vector3 point) {
+    if (object->type == OBJ_CHECKERBOARD && !checkerboard_parity(state, object->checkerboard, point))
+        return &object->checkerboard.material_2;
+    return &object->material;
+}
+
 
 // shapes
 
-Vector3 sphere_normal (Sphere sphere, Vector3 point) {
-    return vec3_normalize(vec3_sub(point, sphere.pos));
+Vector3 sphere_normal (const Render_State *state, Sphere sphere, Vector3 point) {
+    return shade_normalize(state, vec3_sub(point, sphere.pos));
 }
 
-Vector3 plane_normal (Plane plane, Vector3 point) {
-    return vec3_normalize(plane.normal);
+Vector3 plane_normal (const Render_State *state, Plane plane, Vector3 point) {
+    return shade_normalize(state, plane.normal);
 }
 
-Vector3 object_normal (Object object, Vector3 point) {
+Vector3 object_normal (const Render_State *state, Object object, Vector3 point) {
     Vector3 normal = {0};
     switch (object.type) {
         case OBJ_SPHERE:
-            normal = sphere_normal(object.sphere, point);
+            normal = sphere_normal(state, object.sphere, point);
             break;
         case OBJ_PLANE:
-            normal = plane_normal(object.plane, point);
+            normal = plane_normal(state, object.plane, point);
             break;
         case OBJ_CHECKERBOARD:
-            normal = plane_normal(object.checkerboard.plane, point);
+            normal = plane_normal(state, object.checkerboard.plane, point);
             break;
     }
 
@@ -299,14 +557,19 @@ Vector3 parametric_line (float t, Ray ray) {
     return point;
 }
 
-bool intersect_plane (Ray ray, Plane plane, float *parametric_hit) {
+// all the intersect functions only count hits between tmin and tmax along
+// the ray. intersect_scene shrinks tmax every time it finds something
+// closer, so objects further away can be thrown out early, before a square
+// root or a normal gets worked out for them
+
+bool intersect_plane (Ray ray, Plane plane, float tmin, float tmax, float *parametric_hit) {
     // ax + by + cz = plane_offset
     float plane_offset = vec3_dot(plane.normal, plane.pos);
 
     float x = (plane_offset - vec3_dot(plane.normal, ray.pos))
         / vec3_dot(plane.normal, ray.dir);
 
-    if (x > 0) {
+    if (x > tmin && x < tmax) {
         if (parametric_hit != NULL) *parametric_hit = x;
         return true;
     }
@@ -314,7 +577,7 @@ bool intersect_plane (Ray ray, Plane plane, float *parametric_hit) {
     return false;
 }
 
-bool intersect_anti_sphere (Ray ray, Sphere sphere, float *parametric_hit) {
+bool intersect_anti_sphere (Ray ray, Sphere sphere, float tmin, float tmax, float *parametric_hit) {
     Vector3 sphere_off = vec3_sub(ray.pos, sphere.pos);
 
     // this is based on setting a sphere equation equal to a line equation
@@ -327,30 +590,28 @@ bool intersect_anti_sphere (Ray ray, Sphere sphere, float *parametric_hit) {
 
     int num_answers = quadform_only_positive(a, b, c, answers);
 
+    // the far side is the one that counts
+    float x;
     switch (num_answers) {
         case 0:
             return false;
 
         case 1:
-            if (parametric_hit != NULL)
-                *parametric_hit = answers[0];
-            return true;
+            x = answers[0];
+            break;
 
         case 2:
-            if (parametric_hit != NULL)
-                if (answers[0] > answers[1])
-                    *parametric_hit = answers[0];
-                else
-                    *parametric_hit = answers[1];
-            return true;
+            x = answers[0] > answers[1] ? answers[0] : answers[1];
+            break;
 
         default:
             DEBUG_PRINT("Something is seriously messed up.");
             return false;
     }
 
-    if (num_answers > 0) return true;
-    return false;
+    if (x < tmin || x >= tmax) return false;
+    if (parametric_hit != NULL) *parametric_hit = x;
+    return true;
 }
 
 // these inside functions are used for the indented sphere and stuff, the inside_plane
@@ -384,7 +645,7 @@ bool inside_object (Vector3 point, Object object) {
     }
 }
 
-bool intersect_sphere (Ray ray, Sphere sphere, float *parametric_hit) {
+bool intersect_sphere (Ray ray, Sphere sphere, float tmin, float tmax, float *parametric_hit) {
     Vector3 sphere_off = vec3_sub(ray.pos, sphere.pos);
 
     float a = sq(ray.dir.x) + sq(ray.dir.y) + sq(ray.dir.z);
@@ -392,44 +653,44 @@ bool intersect_sphere (Ray ray, Sphere sphere, float *parametric_hit) {
         2.0f*ray.dir.z*sphere_off.z;
     float c = sq(sphere_off.x) + sq(sphere_off.y) + sq(sphere_off.z) - sq(sphere.r);
 
+    // when the ray starts outside the sphere the near side is the hit, and
+    // that's at (-b - root) / 2a. if even that is past tmax it's no good,
+    // which can be checked with squares instead of taking the root
+    if (c > 0.0f && tmax < INFINITY) {
+        float past = -b - 2.0f * a * tmax;
+        if (past >= 0.0f && past * past >= b*b - 4.0f*a*c) return false;
+    }
+
     float answers[2];
 
     int num_answers = quadform_only_positive(a, b, c, answers);
 
-    switch (num_answers) {
-        case 0:
-            return false;
-
-        case 1:
-            if (parametric_hit != NULL)
-                *parametric_hit = answers[0];
-            return true;
-
-        case 2:
-            if (parametric_hit != NULL)
-                if (answers[0] < answers[1])
-                    *parametric_hit = answers[0];
-                else
-                    *parametric_hit = answers[1];
-            return true;
-
-        default:
-            DEBUG_PRINT("Something is seriously messed up.");
-            return false;
+    // the closest one that's far enough along
+    float x = INFINITY;
+    for (int i = 0; i < num_answers; i++) {
+        if (answers[i] >= tmin && answers[i] < x) x = answers[i];
     }
 
-    if (num_answers > 0) return true;
-    return false;
+    if (x >= tmax) return false;
+    if (parametric_hit != NULL) *parametric_hit = x;
+    return true;
 }
 
-bool intersect_object (Ray ray, Object object, float *hit, Vector3 *hit_normal) {
-    bool intersect = false;
+// which part of an indent sphere got hit
+typedef enum Hit_Part {
+    HIT_OUTSIDE, // the real sphere, or any other object
+    HIT_DENT     // the inside of the anti sphere
+} Hit_Part;
+
+// finds where the ray hits the object but not the normal, that only gets
+// worked out for the closest hit with object_hit_normal
+bool intersect_object (Ray ray, Object object, float tmin, float tmax, float *hit, Hit_Part *part) {
+    *part = HIT_OUTSIDE;
+
     switch (object.type) {
-        case OBJ_SPHERE: {
-            intersect = intersect_sphere(ray, object.sphere, hit);
-            Vector3 hit_point = parametric_line(*hit, ray);
-            *hit_normal = sphere_normal(object.sphere, hit_point);
-        } break;
+        case OBJ_SPHERE:
+            return intersect_sphere(ray, object.sphere, tmin, tmax, hit);
+
         case OBJ_INDENTSPHERE: {
             // this part basically first checks to see if the ray intersects the real
             // sphere, and then checks if it's inside the 'anti sphere', if it is,
@@ -445,90 +706,182 @@ bool intersect_object (Ray ray, Object object, float *hit, Vector3 *hit_normal)
             Sphere real_sphere = object.indent_sphere.real_sphere;
             Sphere anti_sphere = object.indent_sphere.anti_sphere;
 
+            // from outside the dent is always behind the front of the real
+            // sphere, so if that's past tmax the whole thing is. from inside
+            // the back of the dent can come before the far side
             float initial_hit;
-            intersect = intersect_sphere(ray, real_sphere, &initial_hit);
-            if (!intersect) return false;
+            float real_tmax = inside_sphere(ray.pos, real_sphere) ? INFINITY : tmax;
+            if (!intersect_sphere(ray, real_sphere, tmin, real_tmax, &initial_hit)) return false;
 
             Vector3 hit_point = parametric_line(initial_hit, ray);
 
             // are we inside the anti sphere? (if we are this hit doesn't count)
-            if (inside_sphere(hit_point, anti_sphere)) {
-                intersect = false;
-
-                Ray new_ray;
-                new_ray.pos = ray.pos; //vec3_add(ray.pos, vec3_mul(ray.dir, EPSILON));
-                new_ray.dir = ray.dir;
-
-                // now do we hit the boundry between the antisphere and the normal sphere,
-                // or do we just go right through?
-                float anti_hit;
-                if (intersect_anti_sphere(new_ray, anti_sphere, &anti_hit)) {
-                    Vector3 anti_hit_point = parametric_line(anti_hit, new_ray);
-                    if (inside_sphere(anti_hit_point, real_sphere)) {
-                        *hit = anti_hit;
-                        *hit_normal = vec3_mul(sphere_normal(anti_sphere, anti_hit_point), -1.0f);
-                        intersect = true;
-                    }
-                }
-            } else {
+            if (!inside_sphere(hit_point, anti_sphere)) {
+                if (initial_hit >= tmax) return false;
                 *hit = initial_hit;
-                *hit_normal = sphere_normal(real_sphere, hit_point);
+                return true;
             }
-        } break;
-        case OBJ_PLANE: {
-            intersect = intersect_plane(ray, object.plane, hit);
-            Vector3 hit_point = parametric_line(*hit, ray);
-            *hit_normal = object_normal(object, hit_point);
-        } break;
-        case OBJ_CHECKERBOARD: {
-            intersect = intersect_plane(ray, object.checkerboard.plane, hit);
-            Vector3 hit_point = parametric_line(*hit, ray);
-            *hit_normal = object_normal(object, hit_point);
-        } break;
+
+            // now do we hit the boundry between the antisphere and the normal sphere,
+            // or do we just go right through?
+            float anti_hit;
+            if (intersect_anti_sphere(ray, anti_sphere, tmin, tmax, &anti_hit)) {
+                Vector3 anti_hit_point = parametric_line(anti_hit, ray);
+                if (inside_sphere(anti_hit_point, real_sphere)) {
+                    *hit = anti_hit;
+                    *part = HIT_DENT;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        case OBJ_PLANE:
+            return intersect_plane(ray, object.plane, tmin, tmax, hit);
+
+        case OBJ_CHECKERBOARD:
+            return intersect_plane(ray, object.checkerboard.plane, tmin, tmax, hit);
     }
 
-    
-    return intersect;
+    return false;
 }
 
-// intersects against every object in the scene
-bool intersect_scene (Ray ray, float *hit, int *hit_object, Vector3 *hit_normal) {
-    float closest_hit = INFINITY;
-    int closest_hit_object = -1;
-    Vector3 closest_hit_normal;
+Vector3 object_hit_normal (const Render_State *state, Object object, Ray ray, float hit, Hit_Part part) {
+    Vector3 hit_point = parametric_line(hit, ray);
 
-    bool found_anything = false;
+    switch (object.type) {
+        case OBJ_INDENTSPHERE:
+            if (part == HIT_DENT) return vec3_mul(sphere_normal(state, object.indent_sphere.anti_sphere, hit_point), -1.0f);
+            return sphere_normal(state, object.indent_sphere.real_sphere, hit_point);
 
-    for (int i = 0; i < ARRAY_LEN(scene); i++) {
-        float this_hit;
-        Vector3 this_hit_normal;
+        default:
+            return object_normal(state, object, hit_point);
+    }
+}
 
-        bool intersect = intersect_object(ray, scene[i], &this_hit, &this_hit_normal);
-        
-        if (intersect) {
-            found_anything = true;
+// where in the world a pixel's rays went, for temporal.c. the box around the
+// scene is cut into a FOOTPRINT_GRID^3 grid and every cell a ray goes
+// through gets its bit set in cells. it only has to be right about where
+// rays didn't go, so it's fine for it to mark too much
+#define FOOTPRINT_GRID 16
+#define FOOTPRINT_WORDS (FOOTPRINT_GRID * FOOTPRINT_GRID * FOOTPRINT_GRID / 64)
+
+typedef struct Footprint_Cells {
+    u64 bits[FOOTPRINT_WORDS];
+} Footprint_Cells;
+
+struct Ray_Footprint {
+    float min[3];
+    float cell_size[3];
+    Footprint_Cells cells;
+};
+
+void footprint_set (Footprint_Cells *cells, int x, int y, int z) {
+    int cell = (z * FOOTPRINT_GRID + y) * FOOTPRINT_GRID + x;
+    cells->bits[cell / 64] |= (u64) 1 << (cell % 64);
+}
 
-            if (this_hit < closest_hit) {
-                closest_hit = this_hit;
-                closest_hit_object = i;
-                closest_hit_normal = this_hit_normal;
-            }
+void footprint_mark (Ray_Footprint *footprint, Ray ray, float t0, float t1) {
+    float pos[3] = {ray.pos.x, ray.pos.y, ray.pos.z};
+    float dir[3] = {ray.dir.x, ray.dir.y, ray.dir.z};
+
+    // refraction sometimes makes a ray that's all nan, it can't hit anything
+    if (isnan(pos[0] + pos[1] + pos[2] + dir[0] + dir[1] + dir[2])) return;
+
+    // where the ray is in cells at t = 0 and how many cells it goes per unit
+    // of t, after that everything's in cells
+    float start[3], speed[3];
+    for (int axis = 0; axis < 3; axis++) {
+        float per_cell = 1.0f / footprint->cell_size[axis];
+        start[axis] = (pos[axis] - footprint->min[axis]) * per_cell;
+        speed[axis] = dir[axis] * per_cell;
+    }
+
+    // cut the ray down to the part inside the grid
+    float inverse[3];
+    for (int axis = 0; axis < 3; axis++) {
+        if (speed[axis] == 0.0f) {
+            if (start[axis] < 0.0f || start[axis] > FOOTPRINT_GRID) return;
+            inverse[axis] = INFINITY;
+            continue;
+        }
+
+        inverse[axis] = 1.0f / speed[axis];
+        float ta = -start[axis] * inverse[axis];
+        float tb = (FOOTPRINT_GRID - start[axis]) * inverse[axis];
+        if (ta > tb) { float t = ta; ta = tb; tb = t; }
+        if (ta > t0) t0 = ta;
+        if (tb < t1) t1 = tb;
+    }
+    // a direction that's nearly along an axis can push t0 out to infinity
+    if (t0 > t1 || t0 == INFINITY) return;
+
+    // then step through the cells along it
+    int cell[3], step[3];
+    float next[3], delta[3];
+    for (int axis = 0; axis < 3; axis++) {
+        float at = start[axis] + speed[axis] * t0;
+        cell[axis] = at < 0.0f ? 0 : at >= FOOTPRINT_GRID ? FOOTPRINT_GRID - 1 : (int) at;
+
+        if (speed[axis] > 0.0f) {
+            step[axis] = 1;
+            next[axis] = (cell[axis] + 1 - start[axis]) * inverse[axis];
+            delta[axis] = inverse[axis];
+        } else if (speed[axis] < 0.0f) {
+            step[axis] = -1;
+            next[axis] = (cell[axis] - start[axis]) * inverse[axis];
+            delta[axis] = -inverse[axis];
+        } else {
+            step[axis] = 0;
+            next[axis] = INFINITY;
+            delta[axis] = INFINITY;
         }
     }
 
-    if (found_anything) {
-        if (hit) *hit = closest_hit;
-        if (hit_object) *hit_object = closest_hit_object;
-        if (hit_normal) *hit_normal = closest_hit_normal;
+    for (;;) {
+        footprint_set(&footprint->cells, cell[0], cell[1], cell[2]);
+
+        int axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+        if (next[axis] > t1) break;
+
+        cell[axis] += step[axis];
+        if (cell[axis] < 0 || cell[axis] >= FOOTPRINT_GRID) break;
+        next[axis] += delta[axis];
+    }
+}
+
+// intersects against every object in the scene, the closest hit between tmin
+// and tmax. hit_normal can be NULL for when only whether and where matter
+bool intersect_scene (const Render_State *state, Ray ray, float tmin, float tmax, float *hit, int *hit_object, Vector3 *hit_normal) {
+    float closest_hit = tmax;
+    int closest_hit_object = -1;
+    Hit_Part closest_hit_part = HIT_OUTSIDE;
+
+    for (int i = 0; i < ARRAY_LEN(state->scene); i++) {
+        float this_hit;
+        Hit_Part this_hit_part;
+
+        if (intersect_object(ray, state->scene[i], tmin, closest_hit, &this_hit, &this_hit_part)) {
+            closest_hit = this_hit;
+            closest_hit_object = i;
+            closest_hit_part = this_hit_part;
+        }
     }
 
-    return found_anything;
+    if (state->footprint) footprint_mark(state->footprint, ray, tmin, closest_hit);
+
+    if (closest_hit_object < 0) return false;
+
+    if (hit) *hit = closest_hit;
+    if (hit_object) *hit_object = closest_hit_object;
+    if (hit_normal) *hit_normal = object_hit_normal(state, state->scene[closest_hit_object], ray, closest_hit, closest_hit_part);
+    return true;
 }
 
-Color diffuse_from_light (Light light, Object object, Vector3 point, Vector3 normal) {
+Color diffuse_from_light (const Render_State *state, Light light, Object object, Vector3 point, Vector3 normal) {
     Color result = {0};
 
-    Vector3 direction_to_light = vec3_normalize(vec3_sub(
+    Vector3 direction_to_light = shade_normalize(state, vec3_sub(
         point, light.pos));
 
     float lightness = -1.0f * vec3_dot(direction_to_light, normal);
@@ -543,16 +896,16 @@ Color diffuse_from_light (Light light, Object object, Vector3 point, Vector3 nor
 }
 
 Color specular_from_light (
-    Light light, Object object, Vector3 point, Vector3 normal, Ray sight, Material material
+    const Render_State *state, Light light, Object object, Vector3 point, Vector3 normal, Ray sight, Material material
 ) {
     Color result = {0};
     
-    Vector3 sight_dir = vec3_normalize(sight.dir);
-    Vector3 light_dir = vec3_normalize(vec3_sub(point, light.pos));
+    Vector3 sight_dir = shade_normalize(state, sight.dir);
+    Vector3 light_dir = shade_normalize(state, vec3_sub(point, light.pos));
 
     // dir - normal * 2 (dir . normal)
     Vector3 reflect_light_dir = vec3_sub(light_dir, vec3_mul(normal, 2.0f * vec3_dot(light_dir, normal)));
-    reflect_light_dir = vec3_normalize(reflect_light_dir);
+    reflect_light_dir = shade_normalize(state, reflect_light_dir);
 
     float lightness = -1.0f * vec3_dot(reflect_light_dir, sight_dir);
 
@@ -560,83 +913,141 @@ Color specular_from_light (
     Color specular_color = color_add(color_scale(material.color, sm), color_scale((Color) {1, 1, 1}, 1 - sm));
 
     if (lightness > 0) {
-        result.g = pow(lightness, material.shinyness) * light.color.g;
-        result.b = pow(lightness, material.shinyness) * light.color.b;
-        result.r = pow(lightness, material.shinyness) * light.color.r;
+        float highlight = shade_pow(state, lightness, material.shinyness);
+        result.g = highlight * light.color.g;
+        result.b = highlight * light.color.b;
+        result.r = highlight * light.color.r;
     }
 
     return result;
 }
 
-// figures out diffuse and specular contributions from all lights in the scene
-Color color_from_all_lights (int object_index, Vector3 point, Vector3 normal, Ray sight, Color object_color) {
-    Color result = {0};
+// fires a shadow ray from the point towards target, true if something is
+// in the way before it gets there
+bool shadow_ray_blocked (const Render_State *state, Vector3 point, Vector3 target) {
+    Vector3 point_to_light = vec3_sub(target, point);
 
-    Object object = scene[object_index];
+    Ray shadow_ray = {0};
+    shadow_ray.dir = shade_normalize(state, point_to_light);
+    shadow_ray.pos = vec3_add(point, vec3_mul(shadow_ray.dir, EPSILON));
 
-    Material material = object_material(object, point);
+    // use a shadow ray to see if we hit anything else, anything past the
+    // light doesn't count so it can stop looking there
+    float light_hit = sqrtf(vec3_dot(point_to_light, point_to_light));
+    int hit_object;
+    bool did_we_hit = intersect_scene(state, shadow_ray, 0.0f, light_hit, NULL, &hit_object, NULL);
+
+    // for now just assume translucent objects dont cast any shadow
+    // in the future this could be improved
+    if (did_we_hit) {
+        if (state->scene[hit_object].material.refract) did_we_hit = false;
+    }
 
-    for (int i = 0; i < ARRAY_LEN(lights); i++) {
-        Vector3 point_to_light = vec3_sub(lights[i].pos, point);
+    return did_we_hit;
+}
 
-        Ray shadow_ray = {0};
-        shadow_ray.dir = vec3_normalize(point_to_light);
-        shadow_ray.pos = vec3_add(point, vec3_mul(shadow_ray.dir, EPSILON));
+// true if something is in the way of the light's center
+bool in_shadow (const Render_State *state, Light light, Vector3 point) {
+    return shadow_ray_blocked(state, point, light.pos);
+}
 
-        // use a shadow ray to see if we hit anything else
-        float shadow_hit;
-        int hit_object;
-        bool did_we_hit = intersect_scene(shadow_ray, &shadow_hit, &hit_object, NULL);
+// area light shadows start with SHADOW_PROBES rays, spread over the light.
+// if they all agree the point is fully lit or fully shadowed and that's it,
+// otherwise it's in the penumbra and gets SHADOW_SAMPLES rays in total
+#define SHADOW_PROBES 4
+#define SHADOW_SAMPLES 32
+
+// sample n of an area light as seen from point. the points are a sobol
+// sequence so any power of two of them is spread out evenly over the light,
+// scrambled differently for every point so the noise doesn't line up
+Vector3 light_sample_point (const Render_State *state, Light light, Vector3 point, int n, u32 seed) {
+    float u = u32_to_unit(reverse_bits((u32) n) ^ seed);
+    float v = u32_to_unit(sobol_2((u32) n) ^ hash_u32(seed));
+
+    if (light.shape == LIGHT_RECT) {
+        return vec3_add(light.pos, vec3_add(
+            vec3_mul(light.edge_u, u - 0.5f), vec3_mul(light.edge_v, v - 0.5f)));
+    }
 
-        // if we hit something we might have still hit the light first
-        if (did_we_hit) {
-            float light_hit = vec3_dot(point_to_light, point_to_light);
-            if (light_hit < sq(shadow_hit)) did_we_hit = false;
-        }
+    // a sphere looks like a disc facing the point, so pick a point on that
+    Vector3 forward = shade_normalize(state, vec3_sub(light.pos, point));
+    Vector3 helper = fabsf(forward.x) < 0.9f ? (Vector3) {1.0f, 0.0f, 0.0f} : (Vector3) {0.0f, 1.0f, 0.0f};
+    Vector3 side = shade_normalize(state, vec3_cross(forward, helper));
+    Vector3 up = vec3_cross(forward, side);
 
-        // for now just assume translucent objects dont cast any shadow
-        // in the future this could be improved
-        if (did_we_hit) {
-            if (scene[hit_object].material.refract) did_we_hit = false;
-        }
-        
-        if (!did_we_hit) {
-            Color diffuse_comp = diffuse_from_light(lights[i], object, point, normal);
-            Color diffuse = color_scale(diffuse_comp, material.diffuseness);
+    float r = light.radius * sqrtf(u);
+    float angle = 2.0f * 3.14159265f * v;
+    return vec3_add(light.pos, vec3_add(vec3_mul(side, r * cosf(angle)), vec3_mul(up, r * sinf(angle))));
+}
+
+u32 point_seed (Vector3 point) {
+    Float_Bits x = { point.x }, y = { point.y }, z = { point.z };
+    return hash_u32(x.i ^ hash_u32(y.i ^ hash_u32(z.i)));
+}
+
+// how much of the light the point can see, from 0 for fully shadowed to 1.
+// point lights are always 0 or 1
+float light_visibility (const Render_State *state, Light light, Vector3 point) {
+    if (light.shape == LIGHT_POINT) return in_shadow(state, light, point) ? 0.0f : 1.0f;
+
+    u32 seed = point_seed(point);
+
+    int lit = 0;
+    for (int n = 0; n < SHADOW_PROBES; n++) {
+        if (!shadow_ray_blocked(state, point, light_sample_point(state, light, point, n, seed))) lit++;
+    }
+    if (lit == 0) return 0.0f;
+    if (lit == SHADOW_PROBES) return 1.0f;
+
+    for (int n = SHADOW_PROBES; n < SHADOW_SAMPLES; n++) {
+        if (!shadow_ray_blocked(state, point, light_sample_point(state, light, point, n, seed))) lit++;
+    }
+    return (float) lit / (float) SHADOW_SAMPLES;
+}
 
-            Color specular_comp = specular_from_light(lights[i], object, point, normal, sight, material);
-            Color specular = color_scale(specular_comp, material.specularness);
+// figures out diffuse and specular contributions from all lights in the scene
+Color color_from_all_lights (const Render_State *state, int object_index, Vector3 point, Vector3 normal, Ray sight, Color object_color) {
+    Color result = {0};
+
+    Object object = state->scene[object_index];
+
+    Material material = object_material(state, object, point);
+
+    for (int i = 0; i < ARRAY_LEN(state->lights); i++) {
+        float visible = light_visibility(state, state->lights[i], point);
+        if (visible > 0.0f) {
+            Color diffuse_comp = diffuse_from_light(state, state->lights[i], object, point, normal);
+            Color diffuse = color_scale(diffuse_comp, material.diffuseness * visible);
 
-            result = color_add(result, color_mul(diffuse, object_color));
-            result = color_add(result, specular);
+            Color specular_comp = specular_from_light(state, state->lights[i], object, point, normal, sight, material);
+            Color specular = color_scale(specular_comp, material.specularness * visible);
+
+            result = color_add_light(state, result, color_mul(diffuse, object_color));
+            result = color_add_light(state, result, specular);
         }
     }
     
     return result; 
 }
 
-Color ray_color (Ray, int);
+Color ray_color (const Render_State *state, Ray, int);
 
-// reflects ray off the normal and finds the color where it hits
-Color get_reflect_color (Ray sight, Vector3 point, Vector3 normal, int depth) {
-    Vector3 dir = vec3_normalize(sight.dir);
+// the ray you get bouncing the sight ray off the normal
+Ray reflect_ray (const Render_State *state, Ray sight, Vector3 point, Vector3 normal) {
+    Vector3 dir = shade_normalize(state, sight.dir);
 
     // dir - normal * 2 (dir . normal)
     Vector3 reflection_dir = vec3_sub(dir, vec3_mul(normal, 2.0f * vec3_dot(dir, normal)));
 
     Ray reflection = {0};
-    reflection.dir = vec3_normalize(reflection_dir);
+    reflection.dir = shade_normalize(state, reflection_dir);
     reflection.pos = vec3_add(point, vec3_mul(reflection.dir, EPSILON));
 
-    Color mirror_color = ray_color(reflection, depth);
-
-    return mirror_color;
+    return reflection;
 }
 
-// refracts ray by the normal and finds the color
-Color get_refract_color(
-    Ray sight, Vector3 point, Vector3 normal, float refract_amount, Object object, int depth
-) {
+// the ray you get bending the sight ray through the surface
+Ray refract_ray (const Render_State *state, Ray sight, Vector3 point, Vector3 normal, float refract_amount, Object object) {
     if (inside_object(
         vec3_sub(point, vec3_mul(sight.dir, EPSILON)),
         object
@@ -648,7 +1059,7 @@ Color get_refract_color(
         normal = vec3_mul(normal, -1);
     }
 
-    Vector3 dir = vec3_normalize(sight.dir);
+    Vector3 dir = shade_normalize(state, sight.dir);
 
     float c1 = -vec3_dot(dir, normal);
     float c2 = sqrt(1 - sq(refract_amount) * (1 - sq(c1)));
@@ -659,14 +1070,48 @@ Color get_refract_color(
     );
 
     Ray refraction = {0};
-    refraction.dir = vec3_normalize(refraction_dir);
+    refraction.dir = shade_normalize(state, refraction_dir);
     refraction.pos = vec3_add(point, vec3_mul(refraction.dir, EPSILON));
 
-    Color refraction_color = ray_color(refraction, depth + 1);
+    return refraction;
+}
+
+// how much of the light goes through a refractive surface instead of being
+// reflected, the rest is reflected
+float fresnel_transmission (const Render_State *state, Ray sight, Vector3 normal, float refract_amount) {
+    Vector3 dir = shade_normalize(state, sight.dir);
+
+    // total internal refelction
+    float cos_t = -vec3_dot(dir, normal);
+    float para = sq(
+        (cos_t - refract_amount * cos_t)/(cos_t + refract_amount * cos_t)
+    );
+    float perp = sq(
+        (refract_amount * cos_t - cos_t)/(refract_amount * cos_t + cos_t)
+    );
+    return 1.0f - (para + perp) / 2;
+}
+
+// reflects ray off the normal and finds the color where it hits
+Color get_reflect_color (const Render_State *state, Ray sight, Vector3 point, Vector3 normal, int depth) {
+    Ray reflection = reflect_ray(state, sight, point, normal);
+
+    Color mirror_color = ray_color(state, reflection, depth);
+
+    return mirror_color;
+}
+
+// refracts ray by the normal and finds the color
+Color get_refract_color(
+    const Render_State *state, Ray sight, Vector3 point, Vector3 normal, float refract_amount, Object object, int depth
+) {
+    Ray refraction = refract_ray(state, sight, point, normal, refract_amount, object);
+
+    Color refraction_color = ray_color(state, refraction, depth + 1);
     return refraction_color;
 }
 
-Color ray_color (Ray sight, int depth) {
+Color ray_color (const Render_State *state, Ray sight, int depth) {
     Color result = {0};
 
     if (depth > 20) {
@@ -679,61 +1124,51 @@ Color ray_color (Ray sight, int depth) {
 
     Vector3 normal;
     
-    if (intersect_scene(sight, &hit, &hit_object, &normal)) {
+    if (intersect_scene(state, sight, 0.0f, INFINITY, &hit, &hit_object, &normal)) {
         Vector3 hit_point = parametric_line(hit, sight);
 
-        Object object = scene[hit_object];
+        Object object = state->scene[hit_object];
 
-        float mirror = object_material(object, hit_point).mirror;
-        int refract = object_material(object, hit_point).refract;
+        float mirror = object_material(state, object, hit_point).mirror;
+        int refract = object_material(state, object, hit_point).refract;
 
         // okay this is kinda hacky, instead of keeping track of indicies of
         // refraction, each thing has a 'refraction_amount' and it just uses that for
         // the ratio of the indicies of refraction
-        float refract_amount = object_material(object, hit_point).refract_amount;
+        float refract_amount = object_material(state, object, hit_point).refract_amount;
 
         if (refract) {
             Color refraction_color = get_refract_color(
-                sight, hit_point, normal, refract_amount, object, depth + 1);
-            Color mirror_color = get_reflect_color(sight, hit_point, normal, depth + 1);
-
-            Vector3 dir = vec3_normalize(sight.dir);
+                state, sight, hit_point, normal, refract_amount, object, depth + 1);
+            Color mirror_color = get_reflect_color(state, sight, hit_point, normal, depth + 1);
 
-            // total internal refelction
-            float cos_t = -vec3_dot(dir, normal);
-            float para = sq(
-                (cos_t - refract_amount * cos_t)/(cos_t + refract_amount * cos_t)
-            );
-            float perp = sq(
-                (refract_amount * cos_t - cos_t)/(refract_amount * cos_t + cos_t)
-            );
-            float transmission = 1.0f - (para + perp) / 2;
+            float transmission = fresnel_transmission(state, sight, normal, refract_amount);
 
             Color final_refraction = color_lerp(mirror_color, refraction_color, transmission);
 
             // apply shading
             Color light_color = color_from_all_lights(
-                hit_object, hit_point, normal, sight, final_refraction); 
+                state, hit_object, hit_point, normal, sight, final_refraction); 
 
             result = final_refraction;
         }
         else if (mirror > 0.0f) {
-            Color mirror_color = get_reflect_color(sight, hit_point, normal, depth + 1);
-            Color base_color = object_material(object, hit_point).color;
+            Color mirror_color = get_reflect_color(state, sight, hit_point, normal, depth + 1);
+            Color base_color = object_material(state, object, hit_point).color;
 
             Color object_color = color_lerp(base_color, mirror_color, mirror);
 
             // apply shading
             Color light_color = color_from_all_lights(
-                hit_object, hit_point, normal, sight, object_color); 
+                state, hit_object, hit_point, normal, sight, object_color); 
 
             result = light_color;
         } else {
 
-            Color base_color = object_material(object, hit_point).color;
+            Color base_color = object_material(state, object, hit_point).color;
 
             // apply shading
-            result = color_from_all_lights(hit_object, hit_point, normal, sight, base_color); 
+            result = color_from_all_lights(state, hit_object, hit_point, normal, sight, base_color); 
         }
     }
 
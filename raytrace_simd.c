@@ -0,0 +1,141 @@
+// sse version of the vector and color functions, this gets included by
+// raytrace_math.c instead of the plain ones when RAYTRACE_SIMD is defined.
+// vectors and colors get a 4th padding lane so they're 16 bytes and can be
+// loaded straight into an xmm register, the padding lane should always be 0.
+
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+// dpps is sse4.1, gcc/clang tell us with __SSE4_1__ and msvc only with /arch:AVX
+#if defined(__SSE4_1__) || defined(__AVX__)
+#include <smmintrin.h>
+#define RAYTRACE_SIMD_DPPS
+#endif
+
+typedef struct ALIGN16 Vector3 {
+    float x;
+    float y;
+    float z;
+    float w;
+} Vector3;
+
+typedef struct ALIGN16 Color {
+    float r;
+    float g;
+    float b;
+    float a;
+} Color;
+
+FORCE_INLINE __m128 vec3_load (Vector3 a) {
+    return _mm_load_ps(&a.x);
+}
+
+FORCE_INLINE Vector3 vec3_store (__m128 m) {
+    Vector3 result;
+    _mm_store_ps(&result.x, m);
+    return result;
+}
+
+FORCE_INLINE __m128 color_load (Color a) {
+    return _mm_load_ps(&a.r);
+}
+
+FORCE_INLINE Color color_store (__m128 m) {
+    Color result;
+    _mm_store_ps(&result.r, m);
+    return result;
+}
+
+// dot product of just the xyz lanes, left in the low lane
+FORCE_INLINE __m128 simd_dot3 (__m128 a, __m128 b) {
+#ifdef RAYTRACE_SIMD_DPPS
+    return _mm_dp_ps(a, b, 0x71);
+#else
+    __m128 m = _mm_mul_ps(a, b);
+    __m128 y = _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1));
+    __m128 z = _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 2, 2, 2));
+    return _mm_add_ss(_mm_add_ss(m, y), z);
+#endif
+}
+
+// vector functions
+
+FORCE_INLINE Vector3 vec3_add (Vector3 a, Vector3 b) {
+    return vec3_store(_mm_add_ps(vec3_load(a), vec3_load(b)));
+}
+
+FORCE_INLINE Vector3 vec3_sub (Vector3 a, Vector3 b) {
+    return vec3_store(_mm_sub_ps(vec3_load(a), vec3_load(b)));
+}
+
+FORCE_INLINE float vec3_dot (Vector3 a, Vector3 b) {
+    return _mm_cvtss_f32(simd_dot3(vec3_load(a), vec3_load(b)));
+}
+
+FORCE_INLINE Vector3 vec3_div (Vector3 a, float b) {
+    return vec3_store(_mm_div_ps(vec3_load(a), _mm_set1_ps(b)));
+}
+
+FORCE_INLINE Vector3 vec3_mul (Vector3 a, float b) {
+    return vec3_store(_mm_mul_ps(vec3_load(a), _mm_set1_ps(b)));
+}
+
+// rsqrtps is only good to about 12 bits so we do one newton-raphson step
+// on it, y' = y * (1.5 - 0.5 * x * y * y), which gets it to about 22 bits
+FORCE_INLINE Vector3 vec3_normalize (Vector3 a) {
+    __m128 v = vec3_load(a);
+    __m128 len_sq = simd_dot3(v, v);
+    len_sq = _mm_shuffle_ps(len_sq, len_sq, _MM_SHUFFLE(0, 0, 0, 0));
+
+    __m128 y = _mm_rsqrt_ps(len_sq);
+    __m128 half_x = _mm_mul_ps(len_sq, _mm_set1_ps(0.5f));
+    __m128 step = _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(half_x, _mm_mul_ps(y, y)));
+    y = _mm_mul_ps(y, step);
+
+    return vec3_store(_mm_mul_ps(v, y));
+}
+
+FORCE_INLINE Vector3 vec3_cross (Vector3 a, Vector3 b) {
+    __m128 va = vec3_load(a);
+    __m128 vb = vec3_load(b);
+
+    // a * b.yzx - a.yzx * b gives the cross product rotated one lane, so
+    // rotate it back at the end. the w lane stays 0 - 0
+    __m128 a_yzx = _mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 b_yzx = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(va, b_yzx), _mm_mul_ps(a_yzx, vb));
+
+    return vec3_store(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+}
+
+// colors and materials
+
+// minps/maxps clamp without any branches
+FORCE_INLINE Color color_add (Color a, Color b) {
+    __m128 sum = _mm_add_ps(color_load(a), color_load(b));
+    sum = _mm_max_ps(sum, _mm_setzero_ps());
+    sum = _mm_min_ps(sum, _mm_set1_ps(1.0f));
+    return color_store(sum);
+}
+
+// adds without clamping, for when you're adding up light that gets scaled
+// down again later
+FORCE_INLINE Color color_sum (Color a, Color b) {
+    return color_store(_mm_add_ps(color_load(a), color_load(b)));
+}
+
+FORCE_INLINE Color color_mul (Color a, Color b) {
+    return color_store(_mm_mul_ps(color_load(a), color_load(b)));
+}
+
+FORCE_INLINE Color color_scale (Color a, float b) {
+    return color_store(_mm_mul_ps(color_load(a), _mm_set1_ps(b)));
+}
+
+// gets color in between two colors in rgb
+FORCE_INLINE Color color_lerp (Color a, Color b, float alpha) {
+    __m128 va = color_load(a);
+    __m128 vb = color_load(b);
+    __m128 t = _mm_set1_ps(alpha);
+    return color_store(_mm_add_ps(va, _mm_mul_ps(t, _mm_sub_ps(vb, va))));
+}
@@ -0,0 +1,316 @@
+#include "raytrace_math.c"
+#include "shade.c"
+#include "sampler.c"
+
+// setup scene
+
+#define MAT_DEFAULT(obj) obj.color = (Color) {1.0f, 1.0f, 1.0f}, obj.mirror = 0.0f, \
+obj.diffuseness = 1.0f, obj.specularness = 0.4f, obj.shinyness = 4.0f, obj.metalness = 0.2f
+
+// fills in the scene and lights of state. the lights are state->light_size
+// across, 0 leaves them as points with hard shadows
+void setup_scene (Render_State *state) {
+    state->scene[1] = (Object) {
+        .type = OBJ_SPHERE,
+
+        .sphere.pos = (Vector3) {8.0f, 1.5f, 22.5f},
+        .sphere.r = 3.0f,
+
+        MAT_DEFAULT(.material),
+        .material.color = (Color) {1.0f, 0.3f, 0.3f},
+    };
+
+    state->scene[2] = (Object) {
+        .type = OBJ_SPHERE,
+
+        .sphere.pos = (Vector3) {0.0f, 3.0f, 25.0f},
+        .sphere.r = 6.0f,
+
+        MAT_DEFAULT(.material),
+        .material.color = (Color) {0.5f, 0.5f, 1.0f},
+        .material.mirror = 0.8f,
+        .material.specularness = 1.0f,
+        .material.diffuseness = 1.0f,
+        .material.shinyness = 30.0f,
+        .material.metalness = 1.0f,
+    };
+
+    state->scene[0] = (Object) {
+        .type = OBJ_SPHERE,
+
+        .sphere.pos = (Vector3) {-9.0f, 1.2f, 25.0f},
+        .sphere.r = 4.0f,
+
+        MAT_DEFAULT(.material),
+        .material.specularness = 0.1,
+        .material.diffuseness  = 0.8,
+        .material.color = (Color) {0.3f, 1.0f, 0.3f},
+    };
+
+    state->scene[5] = (Object) {
+        .type = OBJ_SPHERE,
+
+        .sphere.pos = (Vector3) {9.0f, 4.0f, 18.0f},
+        .sphere.r = 4.0f,
+
+        MAT_DEFAULT(.material),
+        .material.color = (Color) {0.5f, 0.5f, 1.0f},
+        .material.mirror = 0.8f,
+        .material.specularness = 1.0f,
+        .material.diffuseness = 1.0f,
+        .material.shinyness = 30.0f,
+        .material.metalness = 1.0f,
+        .material.refract = 1,
+        .material.refract_amount = 0.5f
+    };
+
+    state->scene[4] = (Object) {
+        .type = OBJ_INDENTSPHERE,
+
+        .indent_sphere.real_sphere.pos = (Vector3) {-2.0f, -7.0f, 19.0f},
+        .indent_sphere.real_sphere.r = 4.0f,
+        .indent_sphere.anti_sphere.pos = (Vector3) {-1.0f, -3.0f, 16.0f},
+        .indent_sphere.anti_sphere.r = 3.0f,
+
+        MAT_DEFAULT(.material),
+        .material.color = (Color) {0.8f, 0.3f, 0.8f},
+        .material.specularness = 1.0,
+        .material.diffuseness = 0.5,
+        .material.shinyness = 25.0,
+        .material.color = (Color) {0.9f, 0.4f, 0.9f},
+        .material.mirror = 0.0f
+    };
+
+    state->scene[3] = (Object) {
+        .type = OBJ_CHECKERBOARD,
+
+        .checkerboard.plane.pos = (Vector3) {0.0f, 3.0f, 27.0f},
+        .checkerboard.plane.normal = (Vector3) {-0.5f, 1.0f, -1.0f},
+
+        MAT_DEFAULT(.material),
+        .material.color = (Color) {1.0f, 1.0f, 1.0f},
+
+        MAT_DEFAULT(.checkerboard.material_2),
+        .checkerboard.material_2.color = (Color) {0.3f, 0.3f, 0.3f},
+
+        .checkerboard.scale = 5.0f
+    };
+    state->scene[3].plane.normal = shade_normalize(state, state->scene[3].plane.normal);
+
+    state->lights[0] = (Light) {
+        .color = (Color) {0.5f, 1.0f, 1.0f},
+        .pos = (Vector3) {20.0f, 15.0f, 15.0f}
+    };
+
+    state->lights[1] = (Light) {
+        .color = (Color) {0.7f, 0.7f, 0.5f},
+        .pos = (Vector3) {5.0f, 0.0f, 5.0f}
+    };
+
+    state->lights[2] = (Light) {
+        .color = (Color) {0.5f, 0.5f, 0.5f},
+        // .pos = (Vector3) {-2.0f, -3.0f, 19.0f},
+        .pos = (Vector3) {2.0f, -7.0f, 14.0f},
+    };
+
+    // the light up at the side becomes a square panel facing the spheres and
+    // the other two become balls
+    if (state->light_size > 0.0f) {
+        Vector3 facing = shade_normalize(state, vec3_sub((Vector3) {0.0f, 0.0f, 25.0f}, state->lights[0].pos));
+        Vector3 across = shade_normalize(state, vec3_cross(facing, (Vector3) {0.0f, 1.0f, 0.0f}));
+        Vector3 down = shade_normalize(state, vec3_cross(facing, across));
+
+        state->lights[0].shape = LIGHT_RECT;
+        state->lights[0].edge_u = vec3_mul(across, state->light_size);
+        state->lights[0].edge_v = vec3_mul(down, state->light_size);
+
+        for (int i = 1; i < ARRAY_LEN(state->lights); i++) {
+            state->lights[i].shape = LIGHT_SPHERE;
+            state->lights[i].radius = state->light_size * 0.5f;
+        }
+    }
+}
+
+// the scene as one block of bytes, so it can be sent to another process or
+// written to a file and mapped back in. Object and Light don't have any
+// pointers in them so the arrays get copied as they are, the header is there
+// to make sure the other side has the same struct layout (RAYTRACE_SIMD
+// changes it)
+
+#define SCENE_BLOB_MAGIC 0x43535452 // "RTSC"
+#define SCENE_BLOB_VERSION 2
+
+typedef struct Scene_Blob_Header {
+    u32 magic;
+    u32 version;
+    u32 object_size;
+    u32 object_count;
+    u32 light_size;
+    u32 light_count;
+} Scene_Blob_Header;
+
+u32 scene_blob_size () {
+    return sizeof(Scene_Blob_Header) + SCENE_OBJECTS * sizeof(Object) + SCENE_LIGHTS * sizeof(Light);
+}
+
+void scene_pack (const Render_State *state, u8 *blob) {
+    Scene_Blob_Header header = {
+        .magic = SCENE_BLOB_MAGIC,
+        .version = SCENE_BLOB_VERSION,
+        .object_size = sizeof(Object),
+        .object_count = ARRAY_LEN(state->scene),
+        .light_size = sizeof(Light),
+        .light_count = ARRAY_LEN(state->lights)
+    };
+
+    memcpy(blob, &header, sizeof(header));
+    memcpy(blob + sizeof(header), state->scene, sizeof(state->scene));
+    memcpy(blob + sizeof(header) + sizeof(state->scene), state->lights, sizeof(state->lights));
+}
+
+// puts the scene into state, false if the blob is from a different build or
+// cut off and then state is left alone
+bool scene_unpack (Render_State *state, const u8 *blob, u32 size) {
+    Scene_Blob_Header header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, blob, sizeof(header));
+
+    if (header.magic != SCENE_BLOB_MAGIC || header.version != SCENE_BLOB_VERSION) return false;
+    if (header.object_size != sizeof(Object) || header.object_count != ARRAY_LEN(state->scene)) return false;
+    if (header.light_size != sizeof(Light) || header.light_count != ARRAY_LEN(state->lights)) return false;
+    if (size != scene_blob_size()) return false;
+
+    memcpy(state->scene, blob + sizeof(header), sizeof(state->scene));
+    memcpy(state->lights, blob + sizeof(header) + sizeof(state->scene), sizeof(state->lights));
+    return true;
+}
+
+#include "threads.c"
+
+// the ray for one of the samples*samples samples of a pixel in a width x
+// height image
+Ray primary_ray (const Render_State *state, int x, int y, int width, int height, int sample, int samples) {
+    // how far across and up the picture the pixel is
+    const Camera *camera = &state->camera;
+    float u = (-(float)x + width/2 ) / height * camera->zoom;
+    float v = (-(float)y + height/2) / height * camera->zoom;
+
+    float step = -1.0f / height * camera->zoom;
+
+    if (state->sampler == SAMPLER_GRID) {
+        float sample_step = step / (float) samples;
+        u += sample_step * (float) (sample % samples);
+        v += sample_step * (float) (sample / samples);
+    } else {
+        // see sampler.c
+        float su, sv;
+        sample_point(state->sampler, x, y, sample, samples, &su, &sv);
+        u += step * su;
+        v += step * sv;
+    }
+
+    Ray sight;
+    sight.pos = camera->pos;
+    sight.dir = vec3_add(camera->forward, vec3_add(vec3_mul(camera->left, u), vec3_mul(camera->up, v)));
+
+    return sight;
+}
+
+// traces one pixel of a width x height image, samples is how many rays to
+// use along each side of the pixel so it's samples*samples rays in total
+Color trace_pixel (const Render_State *state, int x, int y, int width, int height, int samples) {
+    Color surface_color = (Color) {
+        .r = 0.0f,
+        .g = 0.0f,
+        .b = 0.0f
+    };
+
+    for (int i = 0; i < samples * samples; i++) {
+        Ray sample_ray = primary_ray(state, x, y, width, height, i, samples);
+
+        Color sample_color = ray_color(state, sample_ray, 0);
+        Color sample_adj = color_scale(sample_color, 1.0f / (float) (samples*samples));
+
+        surface_color = color_add_light(state, sample_adj, surface_color);
+    }
+
+    return surface_color;
+}
+
+// same as trace_pixel for every pixel in a block of the image, but the rays
+// go through the batched shading in shade.c. colors is row major and
+// block_width*block_height long
+void trace_block (
+    const Render_State *state, Color *colors,
+    int x0, int y0, int block_width, int block_height,
+    int width, int height, int samples
+) {
+    Ray rays[SHADE_BATCH_SIZE];
+    Color sample_colors[SHADE_BATCH_SIZE];
+
+    int pixel_count = block_width * block_height;
+    for (int i = 0; i < pixel_count; i++) colors[i] = (Color) {0};
+
+    for (int sample = 0; sample < samples * samples; sample++) {
+        for (int start = 0; start < pixel_count; start += SHADE_BATCH_SIZE) {
+            int count = pixel_count - start;
+            if (count > SHADE_BATCH_SIZE) count = SHADE_BATCH_SIZE;
+
+            for (int i = 0; i < count; i++) {
+                int x = x0 + (start + i) % block_width;
+                int y = y0 + (start + i) / block_width;
+                rays[i] = primary_ray(state, x, y, width, height, sample, samples);
+            }
+
+            shade_rays(state, rays, count, sample_colors, 0);
+
+            for (int i = 0; i < count; i++) {
+                Color sample_adj = color_scale(sample_colors[i], 1.0f / (float) (samples*samples));
+                colors[start + i] = color_add_light(state, sample_adj, colors[start + i]);
+            }
+        }
+    }
+}
+
+// adds up samples first_sample to first_sample + sample_count - 1 of every
+// pixel in a block onto sums, without dividing, for rendering that does a
+// few samples at a time. sums is laid out like colors in trace_block
+void trace_block_samples (
+    const Render_State *state, Color *sums,
+    int x0, int y0, int block_width, int block_height,
+    int width, int height, int samples, int first_sample, int sample_count
+) {
+    Ray rays[SHADE_BATCH_SIZE];
+    Color sample_colors[SHADE_BATCH_SIZE];
+
+    int pixel_count = block_width * block_height;
+
+    for (int sample = first_sample; sample < first_sample + sample_count; sample++) {
+        for (int start = 0; start < pixel_count; start += SHADE_BATCH_SIZE) {
+            int count = pixel_count - start;
+            if (count > SHADE_BATCH_SIZE) count = SHADE_BATCH_SIZE;
+
+            for (int i = 0; i < count; i++) {
+                int x = x0 + (start + i) % block_width;
+                int y = y0 + (start + i) / block_width;
+                rays[i] = primary_ray(state, x, y, width, height, sample, samples);
+            }
+
+            shade_rays(state, rays, count, sample_colors, 0);
+
+            for (int i = 0; i < count; i++) sums[start + i] = color_sum(sums[start + i], sample_colors[i]);
+        }
+    }
+}
+
+// packs a color into the 0xRRGGBB format the window wants
+u32 color_to_pixel (Color color) {
+    u8 green = (u8)(color.g * 255);
+    u8 blue  = (u8)(color.b * 255);
+    u8 red   = (u8)(color.r * 255);
+
+    return ((red << 16) | (green << 8) | blue);
+}
+
+#include "wavefront.c"
+#include "tonemap.c"
@@ -0,0 +1,101 @@
+// where in a pixel each of its samples*samples rays goes. the grid puts them
+// on a regular grid which is what it always did, but on the checkerboard
+// that lines up with the squares and aliases, and it takes lots of samples
+// before it stops. the others spread the points out better:
+//
+//   jitter - one random point in each cell of the grid
+//   halton - the halton sequence in bases 2 and 3
+//   sobol  - the first two sobol dimensions
+//   blue   - the r2 sequence, shifted per pixel by interleaved gradient noise
+//            so the error of neighbouring pixels doesn't look alike, which
+//            is close to blue noise without needing a noise texture
+//
+// everything random comes from hashing the pixel and the sample, so the same
+// pixel always gets the same rays. halton, sobol and blue also get shifted
+// or scrambled per pixel so pixels next to each other don't all use the same
+// points
+
+const char *const sampler_names[SAMPLER_COUNT] = {
+    [SAMPLER_GRID]   = "grid",
+    [SAMPLER_JITTER] = "jitter",
+    [SAMPLER_HALTON] = "halton",
+    [SAMPLER_SOBOL]  = "sobol",
+    [SAMPLER_BLUE]   = "blue",
+};
+
+// -1 if there isn't one called that
+int sampler_from_name (const char *name) {
+    for (int i = 0; i < SAMPLER_COUNT; i++) {
+        if (strcmp(name, sampler_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+u32 pixel_seed (int x, int y) {
+    return hash_u32((u32) x * 0x9E3779B9u ^ hash_u32((u32) y));
+}
+
+float fract (float x) {
+    return x - floorf(x);
+}
+
+float radical_inverse (u32 n, u32 base) {
+    float inverse_base = 1.0f / (float) base;
+    float scale = inverse_base;
+    float result = 0.0f;
+    while (n > 0) {
+        result += (float) (n % base) * scale;
+        n /= base;
+        scale *= inverse_base;
+    }
+    return result;
+}
+
+// jimenez's interleaved gradient noise
+float gradient_noise (float x, float y) {
+    return fract(52.9829189f * fract(0.06711056f * x + 0.00583715f * y));
+}
+
+// where sample number sample of pixel x, y goes with that sampler, as su, sv
+// in [0, 1) across the pixel
+void sample_point (Sampler sampler, int x, int y, int sample, int samples, float *su, float *sv) {
+    u32 seed = pixel_seed(x, y);
+
+    switch (sampler) {
+        case SAMPLER_GRID: {
+            *su = (float) (sample % samples) / (float) samples;
+            *sv = (float) (sample / samples) / (float) samples;
+        } break;
+
+        case SAMPLER_JITTER: {
+            u32 h = hash_u32(seed ^ hash_u32((u32) sample));
+            *su = ((float) (sample % samples) + u32_to_unit(h)) / (float) samples;
+            *sv = ((float) (sample / samples) + u32_to_unit(hash_u32(h))) / (float) samples;
+        } break;
+
+        case SAMPLER_HALTON: {
+            // 0 is (0, 0) in every base so start at 1
+            *su = fract(radical_inverse(sample + 1, 2) + u32_to_unit(seed));
+            *sv = fract(radical_inverse(sample + 1, 3) + u32_to_unit(hash_u32(seed)));
+        } break;
+
+        case SAMPLER_SOBOL: {
+            // xoring every point with the same number keeps how evenly they're
+            // spread out, it just moves them around
+            *su = u32_to_unit(reverse_bits((u32) sample) ^ seed);
+            *sv = u32_to_unit(sobol_2((u32) sample) ^ hash_u32(seed));
+        } break;
+
+        case SAMPLER_BLUE: {
+            float offset_u = gradient_noise((float) x, (float) y);
+            float offset_v = gradient_noise((float) x + 5.588238f, (float) y + 5.588238f);
+            *su = fract(offset_u + 0.7548776662f * (float) (sample + 1));
+            *sv = fract(offset_v + 0.5698402910f * (float) (sample + 1));
+        } break;
+
+        default: {
+            *su = 0.0f;
+            *sv = 0.0f;
+        } break;
+    }
+}
@@ -0,0 +1,171 @@
+// guesses how long tiles will take from how long they took last frame, so
+// the coordinator can hand out the slow ones first and cut them up smaller.
+// tiles with the glass sphere or the mirrors in them take many times longer
+// than ones that are just background, and if one of those is the last tile
+// given out everyone else sits around waiting for it to finish.
+//
+// the image is split into SCHED_CELL sized cells and every cell remembers
+// how many seconds per pixel it took. a tile that comes back spreads its
+// time evenly over its pixels
+
+#define SCHED_CELL 8
+
+// tiles don't get cut smaller than this
+#define SCHED_MIN_TILE 8
+
+// a tile gets cut into four if it's guessed to take more than
+// 1 / (workers * SCHED_SPLIT) of the whole frame
+#define SCHED_SPLIT 4
+
+typedef struct Sched_Cell {
+    float seconds_per_pixel; // from the last frame that finished
+    float seconds;           // what's come in so far this frame
+    int pixels;
+} Sched_Cell;
+
+typedef struct Sched_Costs {
+    int width;
+    int height;
+    int cells_x;
+    int cells_y;
+    Sched_Cell *cells;
+    bool known; // false until a frame has finished
+} Sched_Costs;
+
+typedef struct Sched_Tile {
+    Distrib_Tile tile;
+    float cost;
+} Sched_Tile;
+
+void sched_init (Sched_Costs *costs, int width, int height) {
+    costs->width = width;
+    costs->height = height;
+    costs->cells_x = (width + SCHED_CELL - 1) / SCHED_CELL;
+    costs->cells_y = (height + SCHED_CELL - 1) / SCHED_CELL;
+    costs->cells = calloc(costs->cells_x * costs->cells_y, sizeof(Sched_Cell));
+    costs->known = false;
+}
+
+void sched_free (Sched_Costs *costs) {
+    free(costs->cells);
+    costs->cells = NULL;
+}
+
+// runs body for every cell a tile touches, with overlap set to how many
+// pixels they have in common
+#define SCHED_FOR_CELLS(costs, tile, cell, overlap, body) \
+    for (int cy = (tile).y / SCHED_CELL; cy * SCHED_CELL < (tile).y + (tile).height; cy++) { \
+        for (int cx = (tile).x / SCHED_CELL; cx * SCHED_CELL < (tile).x + (tile).width; cx++) { \
+            Sched_Cell *cell = &(costs)->cells[cy * (costs)->cells_x + cx]; \
+            int x0 = cx * SCHED_CELL > (tile).x ? cx * SCHED_CELL : (tile).x; \
+            int y0 = cy * SCHED_CELL > (tile).y ? cy * SCHED_CELL : (tile).y; \
+            int x1 = (cx + 1) * SCHED_CELL < (tile).x + (tile).width ? (cx + 1) * SCHED_CELL : (tile).x + (tile).width; \
+            int y1 = (cy + 1) * SCHED_CELL < (tile).y + (tile).height ? (cy + 1) * SCHED_CELL : (tile).y + (tile).height; \
+            int overlap = (x1 - x0) * (y1 - y0); \
+            body \
+        } \
+    }
+
+void sched_record (Sched_Costs *costs, Distrib_Tile tile, float seconds) {
+    float per_pixel = seconds / (float) (tile.width * tile.height);
+    SCHED_FOR_CELLS(costs, tile, cell, overlap, {
+        cell->seconds += per_pixel * overlap;
+        cell->pixels += overlap;
+    })
+}
+
+// call when a frame is done, what came in becomes the guess for the next one
+void sched_end_frame (Sched_Costs *costs) {
+    int cell_count = costs->cells_x * costs->cells_y;
+    for (int i = 0; i < cell_count; i++) {
+        Sched_Cell *cell = &costs->cells[i];
+        if (cell->pixels > 0) cell->seconds_per_pixel = cell->seconds / (float) cell->pixels;
+        cell->seconds = 0.0f;
+        cell->pixels = 0;
+    }
+    costs->known = true;
+}
+
+float sched_guess (Sched_Costs *costs, Distrib_Tile tile) {
+    float seconds = 0.0f;
+    SCHED_FOR_CELLS(costs, tile, cell, overlap, {
+        seconds += cell->seconds_per_pixel * overlap;
+    })
+    return seconds;
+}
+
+int sched_compare_cost (const void *a, const void *b) {
+    float cost_a = ((const Sched_Tile *) a)->cost;
+    float cost_b = ((const Sched_Tile *) b)->cost;
+    return (cost_a < cost_b) - (cost_a > cost_b);
+}
+
+// makes the tiles for the next frame and returns how many there are, *tiles
+// gets realloced to fit. before any frame has finished it's the plain grid
+// in rows. after that tiles that are guessed to be slow get cut into four
+// (and again if the quarters are still slow) and they're all sorted so the
+// slowest ones get handed out first
+int sched_plan (Sched_Costs *costs, int tile_size, int workers, Distrib_Tile **tiles) {
+    int tiles_x = (costs->width + tile_size - 1) / tile_size;
+    int tiles_y = (costs->height + tile_size - 1) / tile_size;
+
+    int capacity = tiles_x * tiles_y;
+    int count = 0;
+    Sched_Tile *plan = malloc(capacity * sizeof(Sched_Tile));
+
+    float total = 0.0f;
+    for (int i = 0; i < tiles_x * tiles_y; i++) {
+        int x = (i % tiles_x) * tile_size;
+        int y = (i / tiles_x) * tile_size;
+        Distrib_Tile tile = {
+            .x = x,
+            .y = y,
+            .width = (x + tile_size > costs->width) ? costs->width - x : tile_size,
+            .height = (y + tile_size > costs->height) ? costs->height - y : tile_size
+        };
+        float cost = costs->known ? sched_guess(costs, tile) : 0.0f;
+        plan[count++] = (Sched_Tile) { tile, cost };
+        total += cost;
+    }
+
+    if (costs->known) {
+        float limit = total / (float) ((workers > 0 ? workers : 1) * SCHED_SPLIT);
+
+        // the quarters go on the end so they get looked at again
+        for (int i = 0; i < count; i++) {
+            Distrib_Tile tile = plan[i].tile;
+            if (plan[i].cost <= limit || tile.width < 2 * SCHED_MIN_TILE || tile.height < 2 * SCHED_MIN_TILE) continue;
+
+            if (count + 3 > capacity) {
+                capacity *= 2;
+                plan = realloc(plan, capacity * sizeof(Sched_Tile));
+            }
+
+            int half_width = tile.width / 2;
+            int half_height = tile.height / 2;
+            Distrib_Tile quarters[4] = {
+                { .x = tile.x,              .y = tile.y,               .width = half_width,              .height = half_height },
+                { .x = tile.x + half_width, .y = tile.y,               .width = tile.width - half_width, .height = half_height },
+                { .x = tile.x,              .y = tile.y + half_height, .width = half_width,              .height = tile.height - half_height },
+                { .x = tile.x + half_width, .y = tile.y + half_height, .width = tile.width - half_width, .height = tile.height - half_height },
+            };
+
+            plan[i] = (Sched_Tile) { quarters[0], sched_guess(costs, quarters[0]) };
+            for (int q = 1; q < 4; q++) {
+                plan[count++] = (Sched_Tile) { quarters[q], sched_guess(costs, quarters[q]) };
+            }
+            i--; // the first quarter is in this slot now
+        }
+
+        qsort(plan, count, sizeof(Sched_Tile), sched_compare_cost);
+    }
+
+    *tiles = realloc(*tiles, count * sizeof(Distrib_Tile));
+    for (int i = 0; i < count; i++) {
+        (*tiles)[i] = plan[i].tile;
+        (*tiles)[i].index = i;
+    }
+
+    free(plan);
+    return count;
+}
@@ -0,0 +1,610 @@
+// long running render server, so lots of small renders don't each pay for
+// starting a process and building the scene.
+//
+//     server serve [-a address] [-j threads]
+//     server render [-a address] [-o out.ppm] [-w width] [-h height]
+//                   [-s samples] [-f fast_math] [-p priority] [-n jobs]
+//                   [-c x,y,z] [-t tile_size] [-l scene.blob]
+//     server stop [-a address]
+//
+// address is the same as in net.c, the default is
+// unix:/tmp/raytrace-server.sock.
+//
+// the server keeps every scene it knows about in memory, scene 0 is the
+// built in one from setup_scene and clients can add more by sending a scene
+// blob (see scene_pack). a job names a scene, a camera, the size and the
+// sample settings. jobs wait in a queue, the one with the highest priority
+// goes first and jobs with the same priority go in the order they came in.
+// the server renders one tile at a time and sends each one back as soon as
+// it's done, and looks at the queue again after every tile, so a high
+// priority job doesn't have to wait for a big one to finish. the rows of
+// each tile get split over -j threads (one per cpu by default).
+//
+// jobs can't be bigger than SERVER_MAX_SIZE either way and tiles are cut
+// down to SERVER_MAX_TILE_SIZE and to the size of the image, a client
+// asking for more than that doesn't get to make the server run out of
+// memory. the same goes for messages, nothing a client sends can be bigger
+// than a scene blob or a job, and one that tries gets dropped. a client
+// that stops halfway through a message gets dropped after
+// SERVER_RECV_TIMEOUT_MS instead of holding everyone else up.
+//
+// "server render" is a client that sends -n copies of a job (and the scene
+// from -l first if there is one) and writes the last image it gets back.
+
+#include <poll.h>
+#include <time.h>
+
+#include "render.c"
+#include "output.c"
+#include "net.c"
+
+enum {
+    SERVER_LOAD_SCENE = 1, // scene blob, client -> server
+    SERVER_SCENE_ID,       // u32 scene id, server -> client
+    SERVER_SUBMIT,         // Server_Job_Request, client -> server
+    SERVER_ACCEPTED,       // u32 job id, server -> client
+    SERVER_TILE,           // Server_Tile then the pixels, server -> client
+    SERVER_JOB_DONE,       // Server_Job_Done, server -> client
+    SERVER_ERROR,          // a message as text, server -> client
+    SERVER_STOP            // nothing, client -> server
+};
+
+typedef struct Server_Job_Request {
+    s32 scene_id;
+    s32 priority; // bigger goes first
+    Camera camera;
+    s32 width;
+    s32 height;
+    s32 samples;
+    s32 fast_math;
+    s32 tile_size;
+} Server_Job_Request;
+
+typedef struct Server_Tile {
+    u32 job_id;
+    s32 x;
+    s32 y;
+    s32 width;
+    s32 height;
+} Server_Tile;
+
+typedef struct Server_Job_Done {
+    u32 job_id;
+    float queued_seconds;   // from when it came in to its first tile
+    float render_seconds;   // from its first tile to its last
+} Server_Job_Done;
+
+#define SERVER_MAX_CLIENTS 64
+#define SERVER_MAX_SCENES 256
+#define SERVER_MAX_JOBS 4096
+#define SERVER_MAX_SIZE 32768
+#define SERVER_MAX_SAMPLES 256
+#define SERVER_MAX_TILE_SIZE 1024
+#define SERVER_MAX_THREADS 256
+#define SERVER_RECV_TIMEOUT_MS 1000
+
+// the biggest thing the server sends, a whole tile
+#define SERVER_MAX_TILE_MESSAGE (sizeof(Server_Tile) + SERVER_MAX_TILE_SIZE * SERVER_MAX_TILE_SIZE * sizeof(u32))
+
+typedef struct Server_Job {
+    u32 id;
+    u64 arrival; // for keeping jobs with the same priority in order
+    int client_fd;
+    Server_Job_Request request;
+    int tiles_x;
+    int tile_count;
+    int next_tile;
+    double submitted;
+    double started;
+} Server_Job;
+
+typedef struct Server_Scene {
+    u8 *blob;
+    u32 size;
+} Server_Scene;
+
+double server_seconds () {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+// server
+
+typedef struct Render_Server {
+    Server_Scene scenes[SERVER_MAX_SCENES];
+    int scene_count;
+    int active_scene; // the one that's in state right now
+    Render_State state;
+
+    Server_Job jobs[SERVER_MAX_JOBS];
+    int job_count;
+    u32 next_job_id;
+    u64 next_arrival;
+
+    int clients[SERVER_MAX_CLIENTS];
+    int client_count;
+
+    int threads;
+    Color *colors;
+    u8 *tile_message;
+} Render_Server;
+
+// one tile being traced by a few threads, they take rows until there
+// aren't any left
+typedef struct Server_Tile_Work {
+    Mutex lock;
+    const Render_State *state;
+    Server_Tile tile;
+    Server_Job_Request *request;
+    Color *colors;
+    int next_row;
+} Server_Tile_Work;
+
+void server_tile_thread (void *param) {
+    Server_Tile_Work *work = param;
+    Server_Tile tile = work->tile;
+
+    for (;;) {
+        mutex_lock(&work->lock);
+        int row = work->next_row++;
+        mutex_unlock(&work->lock);
+        if (row >= tile.height) break;
+
+        trace_block(
+            work->state, work->colors + row * tile.width, tile.x, tile.y + row, tile.width, 1,
+            work->request->width, work->request->height, work->request->samples
+        );
+    }
+}
+
+int server_add_scene (Render_Server *server, const u8 *blob, u32 size) {
+    if (server->scene_count == SERVER_MAX_SCENES) return -1;
+
+    Server_Scene *s = &server->scenes[server->scene_count];
+    s->blob = malloc(size);
+    s->size = size;
+    memcpy(s->blob, blob, size);
+
+    return server->scene_count++;
+}
+
+void server_send_error (int fd, const char *message) {
+    net_send_message(fd, SERVER_ERROR, message, strlen(message));
+}
+
+// picks the job to do a tile of next, -1 if there's nothing to do
+int server_pick_job (Render_Server *server) {
+    int best = -1;
+    for (int i = 0; i < server->job_count; i++) {
+        Server_Job *job = &server->jobs[i];
+        if (best < 0) { best = i; continue; }
+
+        Server_Job *current = &server->jobs[best];
+        if (job->request.priority > current->request.priority ||
+            (job->request.priority == current->request.priority && job->arrival < current->arrival)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+void server_remove_job (Render_Server *server, int index) {
+    server->jobs[index] = server->jobs[--server->job_count];
+}
+
+void server_drop_client (Render_Server *server, int c) {
+    int fd = server->clients[c];
+
+    // nobody to send them to anymore
+    for (int i = server->job_count - 1; i >= 0; i--) {
+        if (server->jobs[i].client_fd == fd) server_remove_job(server, i);
+    }
+
+    close(fd);
+    server->clients[c] = server->clients[--server->client_count];
+}
+
+// false if the client should be dropped
+bool server_handle_message (Render_Server *server, int fd, Net_Header header, u8 *data, bool *running) {
+    switch (header.type) {
+        case SERVER_LOAD_SCENE: {
+            // unpacking it checks that it's good
+            Render_State check = DEFAULT_RENDER_STATE;
+            if (!scene_unpack(&check, data, header.size)) {
+                server_send_error(fd, "scene blob doesn't match this build");
+                return true;
+            }
+
+            u32 id = server_add_scene(server, data, header.size);
+            if (id == (u32) -1) {
+                server_send_error(fd, "too many scenes");
+                return true;
+            }
+            return net_send_message(fd, SERVER_SCENE_ID, &id, sizeof(id));
+        }
+
+        case SERVER_SUBMIT: {
+            if (header.size != sizeof(Server_Job_Request)) return false;
+
+            Server_Job_Request request;
+            memcpy(&request, data, sizeof(request));
+
+            if (request.scene_id < 0 || request.scene_id >= server->scene_count) {
+                server_send_error(fd, "no scene with that id");
+                return true;
+            }
+            if (request.width <= 0 || request.height <= 0 || request.samples <= 0 || request.tile_size <= 0) {
+                server_send_error(fd, "width, height, samples and tile size have to be positive");
+                return true;
+            }
+            if (request.width > SERVER_MAX_SIZE || request.height > SERVER_MAX_SIZE ||
+                request.samples > SERVER_MAX_SAMPLES) {
+                server_send_error(fd, "job is too big");
+                return true;
+            }
+
+            // a tile bigger than the image is just the image
+            int largest = request.width > request.height ? request.width : request.height;
+            if (request.tile_size > largest) request.tile_size = largest;
+            if (request.tile_size > SERVER_MAX_TILE_SIZE) request.tile_size = SERVER_MAX_TILE_SIZE;
+            if (server->job_count == SERVER_MAX_JOBS) {
+                server_send_error(fd, "job queue is full");
+                return true;
+            }
+
+            Server_Job *job = &server->jobs[server->job_count++];
+            job->id = server->next_job_id++;
+            job->arrival = server->next_arrival++;
+            job->client_fd = fd;
+            job->request = request;
+            job->tiles_x = (request.width + request.tile_size - 1) / request.tile_size;
+            job->tile_count = job->tiles_x * ((request.height + request.tile_size - 1) / request.tile_size);
+            job->next_tile = 0;
+            job->submitted = server_seconds();
+            job->started = 0.0;
+
+            return net_send_message(fd, SERVER_ACCEPTED, &job->id, sizeof(job->id));
+        }
+
+        case SERVER_STOP: {
+            *running = false;
+            return true;
+        }
+
+        default:
+            return false;
+    }
+}
+
+// renders the next tile of a job and sends it, false if the client is gone
+bool server_render_tile (Render_Server *server, Server_Job *job) {
+    Server_Job_Request *request = &job->request;
+
+    if (server->active_scene != request->scene_id) {
+        Server_Scene *s = &server->scenes[request->scene_id];
+        scene_unpack(&server->state, s->blob, s->size);
+        server->active_scene = request->scene_id;
+    }
+    server->state.camera = request->camera;
+    server->state.fast_math = request->fast_math;
+
+    if (job->next_tile == 0) job->started = server_seconds();
+
+    int t = job->next_tile++;
+    Server_Tile tile;
+    tile.job_id = job->id;
+    tile.x = (t % job->tiles_x) * request->tile_size;
+    tile.y = (t / job->tiles_x) * request->tile_size;
+    tile.width = request->tile_size;
+    tile.height = request->tile_size;
+    if (tile.x + tile.width > request->width) tile.width = request->width - tile.x;
+    if (tile.y + tile.height > request->height) tile.height = request->height - tile.y;
+
+    int pixel_count = tile.width * tile.height;
+
+    int threads = server->threads < tile.height ? server->threads : tile.height;
+    if (threads <= 1) {
+        trace_block(
+            &server->state, server->colors, tile.x, tile.y, tile.width, tile.height,
+            request->width, request->height, request->samples
+        );
+    } else {
+        Server_Tile_Work work = {
+            .state = &server->state,
+            .tile = tile,
+            .request = request,
+            .colors = server->colors
+        };
+        mutex_init(&work.lock);
+
+        Thread pool[SERVER_MAX_THREADS];
+        for (int i = 0; i < threads; i++) pool[i] = thread_start(server_tile_thread, &work);
+        for (int i = 0; i < threads; i++) thread_join(pool[i]);
+        mutex_free(&work.lock);
+    }
+
+    memcpy(server->tile_message, &tile, sizeof(tile));
+    u32 *pixels = (u32 *) (server->tile_message + sizeof(tile));
+    for (int i = 0; i < pixel_count; i++) pixels[i] = color_to_pixel(server->colors[i]);
+
+    if (!net_send_message(job->client_fd, SERVER_TILE, server->tile_message,
+        sizeof(tile) + pixel_count * sizeof(u32))) return false;
+
+    if (job->next_tile == job->tile_count) {
+        double now = server_seconds();
+        Server_Job_Done done = {
+            .job_id = job->id,
+            .queued_seconds = (float) (job->started - job->submitted),
+            .render_seconds = (float) (now - job->started)
+        };
+        if (!net_send_message(job->client_fd, SERVER_JOB_DONE, &done, sizeof(done))) return false;
+    }
+
+    return true;
+}
+
+int run_server (const char *address, int threads) {
+    int listen_fd = net_listen(address);
+    if (listen_fd < 0) {
+        fprintf(stderr, "server: couldn't listen on %s\n", address);
+        return 1;
+    }
+
+    Render_Server *server = calloc(1, sizeof(Render_Server));
+    server->active_scene = -1;
+    server->state = (Render_State) DEFAULT_RENDER_STATE;
+    server->threads = threads > 0 ? threads : cpu_count();
+    if (server->threads > SERVER_MAX_THREADS) server->threads = SERVER_MAX_THREADS;
+
+    setup_scene(&server->state);
+    u32 blob_size = scene_blob_size();
+    u8 *blob = malloc(blob_size);
+    scene_pack(&server->state, blob);
+    server_add_scene(server, blob, blob_size);
+    free(blob);
+
+    // what clients send is scenes and jobs, there's no reason for anything bigger
+    u32 max_message = blob_size > sizeof(Server_Job_Request) ? blob_size : sizeof(Server_Job_Request);
+
+    Net_Header header;
+    u8 *data = NULL;
+    u32 capacity = 0;
+    int tile_capacity = 0;
+
+    bool running = true;
+    while (running) {
+        struct pollfd fds[SERVER_MAX_CLIENTS + 1];
+        fds[0] = (struct pollfd) { .fd = listen_fd, .events = POLLIN };
+        for (int c = 0; c < server->client_count; c++) {
+            fds[c + 1] = (struct pollfd) { .fd = server->clients[c], .events = POLLIN };
+        }
+
+        // don't wait around if there's rendering to do
+        int timeout = server->job_count ? 0 : 1000;
+        if (poll(fds, server->client_count + 1, timeout) < 0 && errno != EINTR) break;
+
+        for (int c = server->client_count - 1; c >= 0; c--) {
+            if (!(fds[c + 1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+            int fd = server->clients[c];
+            if (!net_recv_message(fd, &header, &data, &capacity, max_message) ||
+                !server_handle_message(server, fd, header, data, &running)) {
+                server_drop_client(server, c);
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = net_accept(listen_fd);
+            if (fd >= 0) {
+                net_set_recv_timeout(fd, SERVER_RECV_TIMEOUT_MS);
+                if (server->client_count < SERVER_MAX_CLIENTS) server->clients[server->client_count++] = fd;
+                else close(fd);
+            }
+        }
+
+        int j = server_pick_job(server);
+        if (j >= 0) {
+            Server_Job *job = &server->jobs[j];
+
+            int tile_pixels = job->request.tile_size * job->request.tile_size;
+            if (tile_pixels > tile_capacity) {
+                tile_capacity = tile_pixels;
+                server->colors = realloc(server->colors, tile_capacity * sizeof(Color));
+                server->tile_message = realloc(server->tile_message,
+                    sizeof(Server_Tile) + tile_capacity * sizeof(u32));
+            }
+
+            int client_fd = job->client_fd;
+            bool ok = server_render_tile(server, job);
+
+            if (!ok) {
+                for (int c = 0; c < server->client_count; c++) {
+                    if (server->clients[c] == client_fd) { server_drop_client(server, c); break; }
+                }
+            } else if (job->next_tile == job->tile_count) {
+                server_remove_job(server, j);
+            }
+        }
+    }
+
+    for (int c = 0; c < server->client_count; c++) close(server->clients[c]);
+    close(listen_fd);
+    if (net_is_unix(address)) unlink(address + 5);
+
+    for (int i = 0; i < server->scene_count; i++) free(server->scenes[i].blob);
+    free(server->colors);
+    free(server->tile_message);
+    free(server);
+    free(data);
+    return 0;
+}
+
+// client
+
+bool read_vector (const char *text, Vector3 *v) {
+    return sscanf(text, "%f,%f,%f", &v->x, &v->y, &v->z) == 3;
+}
+
+int run_client (
+    const char *address, const char *output, const char *scene_path,
+    Server_Job_Request request, int job_count
+) {
+    int fd = net_connect(address);
+    if (fd < 0) {
+        fprintf(stderr, "couldn't connect to %s\n", address);
+        return 1;
+    }
+
+    Net_Header header;
+    u8 *data = NULL;
+    u32 capacity = 0;
+
+    if (scene_path) {
+        FILE *file = fopen(scene_path, "rb");
+        if (!file) {
+            fprintf(stderr, "couldn't open %s\n", scene_path);
+            return 1;
+        }
+        fseek(file, 0, SEEK_END);
+        u32 size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        u8 *blob = malloc(size);
+        fread(blob, 1, size, file);
+        fclose(file);
+
+        bool ok = net_send_message(fd, SERVER_LOAD_SCENE, blob, size) &&
+            net_recv_message(fd, &header, &data, &capacity, SERVER_MAX_TILE_MESSAGE);
+        free(blob);
+
+        if (!ok || header.type != SERVER_SCENE_ID) {
+            fprintf(stderr, "server didn't take the scene\n");
+            return 1;
+        }
+        memcpy(&request.scene_id, data, sizeof(u32));
+    }
+
+    double start = server_seconds();
+
+    for (int i = 0; i < job_count; i++) {
+        if (!net_send_message(fd, SERVER_SUBMIT, &request, sizeof(request))) {
+            fprintf(stderr, "lost the server\n");
+            return 1;
+        }
+    }
+
+    u32 *image = calloc((size_t) request.width * request.height, sizeof(u32));
+    int finished = 0;
+    int result = 0;
+
+    while (finished < job_count) {
+        if (!net_recv_message(fd, &header, &data, &capacity, SERVER_MAX_TILE_MESSAGE)) {
+            fprintf(stderr, "lost the server\n");
+            result = 1;
+            break;
+        }
+
+        if (header.type == SERVER_TILE) {
+            Server_Tile tile;
+            memcpy(&tile, data, sizeof(tile));
+            u32 *pixels = (u32 *) (data + sizeof(tile));
+            for (int y = 0; y < tile.height; y++) {
+                memcpy(
+                    &image[(tile.y + y) * request.width + tile.x],
+                    &pixels[y * tile.width],
+                    tile.width * sizeof(u32)
+                );
+            }
+        } else if (header.type == SERVER_JOB_DONE) {
+            Server_Job_Done done;
+            memcpy(&done, data, sizeof(done));
+            printf("job %u: queued %.1f ms, rendered in %.1f ms\n",
+                done.job_id, done.queued_seconds * 1000.0f, done.render_seconds * 1000.0f);
+            finished++;
+        } else if (header.type == SERVER_ERROR) {
+            fprintf(stderr, "server: %.*s\n", (int) header.size, (char *) data);
+            result = 1;
+            break;
+        }
+    }
+
+    if (finished == job_count) {
+        double elapsed = server_seconds() - start;
+        printf("%d jobs in %.2fs, %.1f jobs/s\n", job_count, elapsed, job_count / elapsed);
+        if (!write_ppm(output, image, request.width, request.height)) {
+            fprintf(stderr, "couldn't write %s\n", output);
+            result = 1;
+        }
+    }
+
+    free(image);
+    free(data);
+    close(fd);
+    return result;
+}
+
+int main (int argc, char **argv) {
+    signal(SIGPIPE, SIG_IGN);
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: server serve|render|stop [options]\n");
+        return 1;
+    }
+
+    const char *address = "unix:/tmp/raytrace-server.sock";
+    const char *output = "raytrace.ppm";
+    const char *scene_path = NULL;
+    int job_count = 1;
+    int threads = 0;
+
+    Server_Job_Request request = {
+        .scene_id = 0,
+        .priority = 0,
+        .camera = DEFAULT_CAMERA,
+        .width = 1280,
+        .height = 720,
+        .samples = 1,
+        .fast_math = 0,
+        .tile_size = 32
+    };
+
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if      (strcmp(argv[i], "-a") == 0) address = argv[i + 1];
+        else if (strcmp(argv[i], "-o") == 0) output = argv[i + 1];
+        else if (strcmp(argv[i], "-l") == 0) scene_path = argv[i + 1];
+        else if (strcmp(argv[i], "-n") == 0) job_count = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-w") == 0) request.width = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-h") == 0) request.height = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-s") == 0) request.samples = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-f") == 0) request.fast_math = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-p") == 0) request.priority = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-t") == 0) request.tile_size = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-j") == 0) threads = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-c") == 0) {
+            if (!read_vector(argv[i + 1], &request.camera.pos)) {
+                fprintf(stderr, "-c wants x,y,z\n");
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (strcmp(argv[1], "serve") == 0) return run_server(address, threads);
+    if (strcmp(argv[1], "render") == 0) return run_client(address, output, scene_path, request, job_count);
+
+    if (strcmp(argv[1], "stop") == 0) {
+        int fd = net_connect(address);
+        if (fd < 0) {
+            fprintf(stderr, "couldn't connect to %s\n", address);
+            return 1;
+        }
+        net_send_message(fd, SERVER_STOP, NULL, 0);
+        close(fd);
+        return 0;
+    }
+
+    fprintf(stderr, "usage: server serve|render|stop [options]\n");
+    return 1;
+}
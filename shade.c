@@ -0,0 +1,186 @@
+// batched shading. ray_color decides what kind of material it hit for every
+// single ray, here a whole batch of rays gets intersected first and the hits
+// get put into bins by material class. every bin is then shaded by a kernel
+// for that class. the kernels all come from shade_bin with the class flags
+// as constants, so each one only has the code its class needs and the light
+// loops don't have any branches in them.
+//
+// only the first hit is batched, mirror and refraction rays still go through
+// ray_color
+
+#define SHADE_BATCH_SIZE 128
+
+typedef enum Shade_Class {
+    SHADE_DIFFUSE,
+    SHADE_MIRROR,
+    SHADE_REFRACT,
+    SHADE_CHECKER,
+    SHADE_CLASS_COUNT
+} Shade_Class;
+
+typedef struct Hit_Bin {
+    int count;
+    int slot[SHADE_BATCH_SIZE]; // index of the ray in the batch
+    int object[SHADE_BATCH_SIZE];
+    const Material *material[SHADE_BATCH_SIZE];
+    Ray sight[SHADE_BATCH_SIZE];
+    Vector3 point[SHADE_BATCH_SIZE];
+    Vector3 normal[SHADE_BATCH_SIZE];
+} Hit_Bin;
+
+Shade_Class material_class (const Material *material) {
+    if (material->refract) return SHADE_REFRACT;
+    if (material->mirror > 0.0f) return SHADE_MIRROR;
+    return SHADE_DIFFUSE;
+}
+
+// checkerboards with two plain squares get the checker kernel which picks the
+// square itself, for anything fancier the square gets picked here and the hit
+// goes to whatever class that square's material is
+void bin_hit (const Render_State *state, Hit_Bin *bins, int slot, int object_index, Ray sight, Vector3 point, Vector3 normal) {
+    const Object *object = &state->scene[object_index];
+    const Material *material = &object->material;
+    Shade_Class class = material_class(material);
+
+    if (object->type == OBJ_CHECKERBOARD) {
+        const Material *material_2 = &object->checkerboard.material_2;
+
+        if (class == SHADE_DIFFUSE && material_class(material_2) == SHADE_DIFFUSE) {
+            class = SHADE_CHECKER;
+        } else {
+            if (!checkerboard_parity(state, object->checkerboard, point)) material = material_2;
+            class = material_class(material);
+        }
+    }
+
+    Hit_Bin *bin = &bins[class];
+    int i = bin->count++;
+
+    bin->slot[i] = slot;
+    bin->object[i] = object_index;
+    bin->material[i] = material;
+    bin->sight[i] = sight;
+    bin->point[i] = point;
+    bin->normal[i] = normal;
+}
+
+FORCE_INLINE void shade_bin (
+    const Render_State *state, Hit_Bin *bin, Color *colors, int depth, bool checker, bool mirror, bool refract
+) {
+    Color object_color[SHADE_BATCH_SIZE];
+    Color result[SHADE_BATCH_SIZE];
+
+    for (int i = 0; i < bin->count; i++) {
+        if (checker) {
+            const Object *object = &state->scene[bin->object[i]];
+            bool parity = checkerboard_parity(state, object->checkerboard, bin->point[i]);
+            bin->material[i] = parity ? &object->material : &object->checkerboard.material_2;
+        }
+
+        object_color[i] = bin->material[i]->color;
+    }
+
+    if (refract) {
+        // refraction gets no lighting, same as in ray_color
+        for (int i = 0; i < bin->count; i++) {
+            Ray sight = bin->sight[i];
+            Vector3 point = bin->point[i];
+            Vector3 normal = bin->normal[i];
+            float refract_amount = bin->material[i]->refract_amount;
+
+            Color refraction_color = get_refract_color(
+                state, sight, point, normal, refract_amount, state->scene[bin->object[i]], depth + 1);
+            Color mirror_color = get_reflect_color(state, sight, point, normal, depth + 1);
+
+            float transmission = fresnel_transmission(state, sight, normal, refract_amount);
+
+            colors[bin->slot[i]] = color_lerp(mirror_color, refraction_color, transmission);
+        }
+        return;
+    }
+
+    if (mirror) {
+        for (int i = 0; i < bin->count; i++) {
+            Color mirror_color = get_reflect_color(
+                state, bin->sight[i], bin->point[i], bin->normal[i], depth + 1);
+            object_color[i] = color_lerp(object_color[i], mirror_color, bin->material[i]->mirror);
+        }
+    }
+
+    for (int i = 0; i < bin->count; i++) result[i] = (Color) {0};
+
+    for (int l = 0; l < ARRAY_LEN(state->lights); l++) {
+        Light light = state->lights[l];
+        float visible[SHADE_BATCH_SIZE];
+
+        // the shadow rays can't be done without branching so they get their
+        // own loop, the one after it is straight math
+        for (int i = 0; i < bin->count; i++) {
+            visible[i] = light_visibility(state, light, bin->point[i]);
+        }
+
+        for (int i = 0; i < bin->count; i++) {
+            const Material *material = bin->material[i];
+            Vector3 normal = bin->normal[i];
+            Vector3 sight_dir = shade_normalize(state, bin->sight[i].dir);
+            Vector3 light_dir = shade_normalize(state, vec3_sub(bin->point[i], light.pos));
+
+            float diffuse = fmaxf(-vec3_dot(light_dir, normal), 0.0f);
+
+            // dir - normal * 2 (dir . normal)
+            Vector3 reflect_light_dir = shade_normalize(state, vec3_sub(
+                light_dir, vec3_mul(normal, 2.0f * vec3_dot(light_dir, normal))));
+            float lightness = fmaxf(-vec3_dot(reflect_light_dir, sight_dir), 0.0f);
+            float specular = shade_pow(state, lightness, material->shinyness);
+
+            diffuse *= material->diffuseness * visible[i];
+            specular *= material->specularness * visible[i];
+
+            result[i] = color_add_light(state, result[i], color_mul(color_scale(light.color, diffuse), object_color[i]));
+            result[i] = color_add_light(state, result[i], color_scale(light.color, specular));
+        }
+    }
+
+    for (int i = 0; i < bin->count; i++) colors[bin->slot[i]] = result[i];
+}
+
+#define SHADE_KERNEL(name, checker, mirror, refract) \
+    void name (const Render_State *state, Hit_Bin *bin, Color *colors, int depth) { \
+        shade_bin(state, bin, colors, depth, checker, mirror, refract); \
+    }
+
+SHADE_KERNEL(shade_diffuse, false, false, false)
+SHADE_KERNEL(shade_mirror,  false, true,  false)
+SHADE_KERNEL(shade_refract, false, false, true)
+SHADE_KERNEL(shade_checker, true,  false, false)
+
+void (*const shade_kernels[SHADE_CLASS_COUNT]) (const Render_State *, Hit_Bin *, Color *, int) = {
+    [SHADE_DIFFUSE] = shade_diffuse,
+    [SHADE_MIRROR]  = shade_mirror,
+    [SHADE_REFRACT] = shade_refract,
+    [SHADE_CHECKER] = shade_checker,
+};
+
+// intersects and shades up to SHADE_BATCH_SIZE rays, colors[i] is the color
+// for rays[i] and comes out the same as ray_color(state, rays[i], depth)
+void shade_rays (const Render_State *state, Ray *rays, int count, Color *colors, int depth) {
+    Hit_Bin bins[SHADE_CLASS_COUNT];
+    for (int c = 0; c < SHADE_CLASS_COUNT; c++) bins[c].count = 0;
+
+    for (int i = 0; i < count; i++) {
+        colors[i] = (Color) {0};
+
+        float hit;
+        int hit_object;
+        Vector3 normal;
+
+        if (intersect_scene(state, rays[i], 0.0f, INFINITY, &hit, &hit_object, &normal)) {
+            Vector3 hit_point = parametric_line(hit, rays[i]);
+            bin_hit(state, bins, i, hit_object, rays[i], hit_point, normal);
+        }
+    }
+
+    for (int c = 0; c < SHADE_CLASS_COUNT; c++) {
+        if (bins[c].count) shade_kernels[c](state, &bins[c], colors, depth);
+    }
+}
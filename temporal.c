@@ -0,0 +1,212 @@
+// reusing pixels from the last frame of an animation. the frame is traced
+// in small tiles with the state's footprint set, so each tile comes out with which
+// cells of a grid over the scene its rays went through, shadow rays and
+// bounces included. on the next frame each object that changed marks the
+// cells it was in and the cells it's in now, and only the tiles whose rays
+// went through one of those get traced again. the rest can't have changed:
+// none of their rays went near anything that moved
+//
+// keeping the footprint makes tracing a tile about half as slow again, and
+// a tile that saw something move will most likely see it move next frame
+// too. so once that happens the tile is traced for TEMPORAL_REST frames
+// without one, just counting as changed, and then gets one again to see if
+// it can be kept
+//
+// anything the grid can't say anything about traces the whole frame again,
+// that's the camera, the lights or the settings changing, a plane changing
+// (they go on forever) and an object going outside the grid. the grid gets
+// fitted to the scene again when that happens
+
+#define TEMPORAL_TILE_SIZE 8
+#define TEMPORAL_REST 8
+
+typedef struct Temporal_Cache {
+    int width;
+    int height;
+    int samples;
+    int tiles_x;
+    int tile_count;
+
+    bool traced;          // false before the first frame
+    Render_State state;   // what the last frame was traced with
+    Ray_Footprint grid;   // the cells are unused, only the box
+
+    Color *colors;        // per pixel, the last frame
+    Footprint_Cells *cells; // per tile, where its rays went
+    bool *cells_ok;         // per tile, false if it was traced without a footprint
+    u8 *rest;               // per tile, frames left without a footprint
+} Temporal_Cache;
+
+void temporal_init (Temporal_Cache *cache, int width, int height, int samples) {
+    int tiles_x = (width + TEMPORAL_TILE_SIZE - 1) / TEMPORAL_TILE_SIZE;
+    int tile_count = tiles_x * ((height + TEMPORAL_TILE_SIZE - 1) / TEMPORAL_TILE_SIZE);
+
+    *cache = (Temporal_Cache) {
+        .width = width,
+        .height = height,
+        .samples = samples,
+        .tiles_x = tiles_x,
+        .tile_count = tile_count,
+        .colors = malloc((size_t) width * height * sizeof(Color)),
+        .cells = malloc(tile_count * sizeof(Footprint_Cells)),
+        .cells_ok = calloc(tile_count, sizeof(bool)),
+        .rest = calloc(tile_count, sizeof(u8))
+    };
+}
+
+void temporal_free (Temporal_Cache *cache) {
+    free(cache->colors);
+    free(cache->cells);
+    free(cache->cells_ok);
+    free(cache->rest);
+}
+
+// the box around an object, false for planes
+bool object_bounds (Object object, float *lo, float *hi) {
+    Sphere sphere;
+    switch (object.type) {
+        case OBJ_SPHERE: sphere = object.sphere; break;
+        case OBJ_INDENTSPHERE: sphere = object.indent_sphere.real_sphere; break;
+        default: return false;
+    }
+
+    float pos[3] = {sphere.pos.x, sphere.pos.y, sphere.pos.z};
+    for (int axis = 0; axis < 3; axis++) {
+        lo[axis] = pos[axis] - sphere.r;
+        hi[axis] = pos[axis] + sphere.r;
+    }
+    return true;
+}
+
+// fits the grid around the objects with some room for them to move. the
+// lights and the camera can be outside it, rays only matter where there's
+// something that could move into their way
+void temporal_fit_grid (Temporal_Cache *cache, const Render_State *state) {
+    float lo[3] = {INFINITY, INFINITY, INFINITY};
+    float hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+
+    for (int i = 0; i < ARRAY_LEN(state->scene); i++) {
+        float object_lo[3], object_hi[3];
+        if (!object_bounds(state->scene[i], object_lo, object_hi)) continue;
+        for (int axis = 0; axis < 3; axis++) {
+            if (object_lo[axis] < lo[axis]) lo[axis] = object_lo[axis];
+            if (object_hi[axis] > hi[axis]) hi[axis] = object_hi[axis];
+        }
+    }
+
+    for (int axis = 0; axis < 3; axis++) {
+        if (lo[axis] > hi[axis]) lo[axis] = hi[axis] = 0.0f; // only planes
+
+        float room = 1.0f;
+        cache->grid.min[axis] = lo[axis] - room;
+        cache->grid.cell_size[axis] = (hi[axis] - lo[axis] + 2.0f * room) / FOOTPRINT_GRID;
+    }
+}
+
+// the cells an object's box touches, false if it's not all inside the grid
+bool temporal_object_cells (Temporal_Cache *cache, Object object, Footprint_Cells *cells) {
+    float lo[3], hi[3];
+    if (!object_bounds(object, lo, hi)) return false;
+
+    // a bit bigger so a ray that footprint_mark put in the next cell over
+    // because of rounding still counts
+    int first[3], last[3];
+    for (int axis = 0; axis < 3; axis++) {
+        float size = cache->grid.cell_size[axis];
+        float a = (lo[axis] - cache->grid.min[axis]) / size - 0.001f;
+        float b = (hi[axis] - cache->grid.min[axis]) / size + 0.001f;
+        if (a < 0.0f || b >= FOOTPRINT_GRID) return false;
+        first[axis] = (int) a;
+        last[axis] = (int) b;
+    }
+
+    for (int z = first[2]; z <= last[2]; z++) {
+        for (int y = first[1]; y <= last[1]; y++) {
+            for (int x = first[0]; x <= last[0]; x++) {
+                footprint_set(cells, x, y, z);
+            }
+        }
+    }
+    return true;
+}
+
+// finds the cells where something changed since the last frame, false if
+// it can't tell and everything has to be traced again
+bool temporal_changed_cells (Temporal_Cache *cache, const Render_State *state, Footprint_Cells *cells) {
+    Render_State *last = &cache->state;
+
+    if (!cache->traced) return false;
+    if (memcmp(last->lights, state->lights, sizeof(state->lights)) != 0) return false;
+    if (memcmp(&last->camera, &state->camera, sizeof(state->camera)) != 0) return false;
+    if (last->fast_math != state->fast_math || last->hdr != state->hdr || last->sampler != state->sampler) return false;
+
+    *cells = (Footprint_Cells) {0};
+    for (int i = 0; i < ARRAY_LEN(state->scene); i++) {
+        if (memcmp(&last->scene[i], &state->scene[i], sizeof(Object)) == 0) continue;
+        if (!temporal_object_cells(cache, last->scene[i], cells)) return false;
+        if (!temporal_object_cells(cache, state->scene[i], cells)) return false;
+    }
+    return true;
+}
+
+bool footprints_overlap (const Footprint_Cells *a, const Footprint_Cells *b) {
+    u64 overlap = 0;
+    for (int i = 0; i < FOOTPRINT_WORDS; i++) overlap |= a->bits[i] & b->bits[i];
+    return overlap != 0;
+}
+
+// traces the frame for state into cache->colors, gives back how many pixels
+// came from the last frame
+int temporal_trace_frame (Temporal_Cache *cache, const Render_State *state) {
+    int width = cache->width;
+    int height = cache->height;
+    int size = TEMPORAL_TILE_SIZE;
+
+    Footprint_Cells changed;
+    bool keep_any = temporal_changed_cells(cache, state, &changed);
+    if (!keep_any) temporal_fit_grid(cache, state);
+
+    Ray_Footprint footprint = cache->grid;
+    Render_State traced = *state;
+
+    Color colors[TEMPORAL_TILE_SIZE * TEMPORAL_TILE_SIZE];
+    int reused = 0;
+
+    for (int t = 0; t < cache->tile_count; t++) {
+        int x = (t % cache->tiles_x) * size;
+        int y = (t / cache->tiles_x) * size;
+        int tile_width = x + size > width ? width - x : size;
+        int tile_height = y + size > height ? height - y : size;
+
+        if (keep_any && cache->cells_ok[t]) {
+            if (!footprints_overlap(&cache->cells[t], &changed)) {
+                reused += tile_width * tile_height;
+                continue;
+            }
+            cache->rest[t] = TEMPORAL_REST;
+        }
+        if (!keep_any) cache->rest[t] = 0;
+
+        bool record = cache->rest[t] == 0;
+        if (record) {
+            footprint.cells = (Footprint_Cells) {0};
+        } else {
+            cache->rest[t]--;
+        }
+
+        traced.footprint = record ? &footprint : NULL;
+        trace_block(&traced, colors, x, y, tile_width, tile_height, width, height, cache->samples);
+
+        cache->cells[t] = footprint.cells;
+        cache->cells_ok[t] = record;
+
+        for (int row = 0; row < tile_height; row++) {
+            memcpy(cache->colors + (size_t) (y + row) * width + x, colors + row * tile_width, tile_width * sizeof(Color));
+        }
+    }
+
+    cache->state = *state;
+    cache->state.footprint = NULL;
+    cache->traced = true;
+    return reused;
+}
@@ -0,0 +1,230 @@
+// threads, locks and condition variables that work the same on windows and
+// on everything with pthreads
+
+#ifdef _WIN32
+
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE Condition;
+
+#else
+
+// pthread_setaffinity_np and cpu_set_t need _GNU_SOURCE before the first
+// #include, the Makefile passes it
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#error "build with -D_GNU_SOURCE, see the Makefile"
+#endif
+
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Condition;
+
+#endif
+
+typedef void (*Thread_Proc) (void *param);
+
+typedef struct Thread_Start {
+    Thread_Proc proc;
+    void *param;
+    int cpu; // -1 to go anywhere
+} Thread_Start;
+
+#define MAX_CPUS 1024
+
+// keeps the calling thread on one cpu
+void thread_pin (int cpu) {
+    if (cpu < 0 || cpu >= MAX_CPUS) return;
+#ifdef _WIN32
+    if (cpu < 64) SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) 1 << cpu);
+#elif defined(__linux__)
+    if (cpu >= CPU_SETSIZE) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+// the two apis want different function types, so every thread starts here
+// and calls the real one
+#ifdef _WIN32
+DWORD WINAPI thread_trampoline (LPVOID start_param) {
+#else
+void *thread_trampoline (void *start_param) {
+#endif
+    Thread_Start *start = start_param;
+    thread_pin(start->cpu);
+    Thread_Proc proc = start->proc;
+    void *param = start->param;
+    free(start);
+    proc(param);
+    return 0;
+}
+
+// like thread_start but the thread stays on that cpu (see cpu_layout_place)
+Thread thread_start_on (Thread_Proc proc, void *param, int cpu) {
+    Thread_Start *start = malloc(sizeof(Thread_Start));
+    start->proc = proc;
+    start->param = param;
+    start->cpu = cpu;
+
+#ifdef _WIN32
+    return CreateThread(0, 0, thread_trampoline, start, 0, 0);
+#else
+    pthread_t thread;
+    pthread_create(&thread, NULL, thread_trampoline, start);
+    return thread;
+#endif
+}
+
+Thread thread_start (Thread_Proc proc, void *param) {
+    return thread_start_on(proc, param, -1);
+}
+
+void thread_join (Thread thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+// how many threads the machine can run at once
+int cpu_count () {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int) info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int) count : 1;
+#endif
+}
+
+// which cpus are on which numa node. on machines with more than one socket
+// each socket has its own memory and getting at the other one's is slower.
+// memory goes on the node of the thread that first writes to it, so a
+// thread that stays on one node and does its own part of the image keeps
+// its part of the image close by
+typedef struct Cpu_Layout {
+    int node_count;
+    int cpu_count;
+    int cpus[MAX_CPUS];  // grouped by node
+    int nodes[MAX_CPUS]; // the node of each of those, counted from 0
+} Cpu_Layout;
+
+void cpu_layout_add (Cpu_Layout *layout, int cpu, int node) {
+    if (layout->cpu_count >= MAX_CPUS) return;
+    layout->cpus[layout->cpu_count] = cpu;
+    layout->nodes[layout->cpu_count] = node;
+    layout->cpu_count++;
+}
+
+void cpu_layout (Cpu_Layout *layout) {
+    layout->node_count = 0;
+    layout->cpu_count = 0;
+
+#ifdef _WIN32
+    ULONG highest = 0;
+    if (GetNumaHighestNodeNumber(&highest)) {
+        for (ULONG n = 0; n <= highest && n < 64; n++) {
+            ULONGLONG mask = 0;
+            if (!GetNumaNodeProcessorMask((UCHAR) n, &mask) || !mask) continue;
+            for (int cpu = 0; cpu < 64; cpu++) {
+                if (mask & ((ULONGLONG) 1 << cpu)) cpu_layout_add(layout, cpu, layout->node_count);
+            }
+            layout->node_count++;
+        }
+    }
+#else
+    // /sys/devices/system/node/node0/cpulist is like "0-7,16-23"
+    for (int n = 0; n < 64; n++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+        FILE *file = fopen(path, "r");
+        if (!file) continue;
+
+        int before = layout->cpu_count;
+        int first, last;
+        while (fscanf(file, "%d", &first) == 1) {
+            last = first;
+            int c = fgetc(file);
+            if (c == '-') {
+                if (fscanf(file, "%d", &last) != 1) break;
+                c = fgetc(file);
+            }
+            for (int cpu = first; cpu <= last; cpu++) cpu_layout_add(layout, cpu, layout->node_count);
+            if (c != ',') break;
+        }
+        fclose(file);
+
+        if (layout->cpu_count > before) layout->node_count++;
+    }
+#endif
+
+    // no numa information, then it's all one node
+    if (layout->cpu_count == 0) {
+        int count = cpu_count();
+        for (int cpu = 0; cpu < count; cpu++) cpu_layout_add(layout, cpu, 0);
+        layout->node_count = 1;
+    }
+}
+
+// the cpu for the index'th thread of a pool and which node that's on, or -1
+// for no particular cpu. the
+// threads go round the nodes so every node gets used, and then round the
+// cpus of each node
+int cpu_layout_place (const Cpu_Layout *layout, int index, int *node) {
+    *node = index % layout->node_count;
+
+    int first = 0;
+    int count = 0;
+    for (int i = 0; i < layout->cpu_count; i++) {
+        if (layout->nodes[i] != *node) continue;
+        if (count == 0) first = i;
+        count++;
+    }
+
+    // past MAX_CPUS a node can be counted without any of its cpus making it
+    // in, its threads go anywhere
+    if (count == 0) return -1;
+    return layout->cpus[first + (index / layout->node_count) % count];
+}
+
+void sleep_ms (int ms) {
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    usleep(ms * 1000);
+#endif
+}
+
+#ifdef _WIN32
+
+void mutex_init (Mutex *mutex) { InitializeCriticalSection(mutex); }
+void mutex_free (Mutex *mutex) { DeleteCriticalSection(mutex); }
+void mutex_lock (Mutex *mutex) { EnterCriticalSection(mutex); }
+void mutex_unlock (Mutex *mutex) { LeaveCriticalSection(mutex); }
+
+void condition_init (Condition *condition) { InitializeConditionVariable(condition); }
+void condition_free (Condition *condition) { (void) condition; }
+void condition_wait (Condition *condition, Mutex *mutex) { SleepConditionVariableCS(condition, mutex, INFINITE); }
+void condition_wake_all (Condition *condition) { WakeAllConditionVariable(condition); }
+
+#else
+
+void mutex_init (Mutex *mutex) { pthread_mutex_init(mutex, NULL); }
+void mutex_free (Mutex *mutex) { pthread_mutex_destroy(mutex); }
+void mutex_lock (Mutex *mutex) { pthread_mutex_lock(mutex); }
+void mutex_unlock (Mutex *mutex) { pthread_mutex_unlock(mutex); }
+
+void condition_init (Condition *condition) { pthread_cond_init(condition, NULL); }
+void condition_free (Condition *condition) { pthread_cond_destroy(condition); }
+void condition_wait (Condition *condition, Mutex *mutex) { pthread_cond_wait(condition, mutex); }
+void condition_wake_all (Condition *condition) { pthread_cond_broadcast(condition); }
+
+#endif
@@ -0,0 +1,101 @@
+// turns the linear float colors the tracer makes into 0xRRGGBB pixels. it's
+// its own pass over the whole frame so the same render can be shown at a
+// different exposure or with a different curve without tracing it again
+// (headless -i takes a .hdr file and only does this part).
+//
+// it does four pixels at a time with sse, the colors get transposed so each
+// register has one channel of four pixels. the default settings give exactly
+// what color_to_pixel gives
+
+#include <emmintrin.h>
+
+#define TONEMAP_LUT_SIZE 4096
+
+typedef enum Tonemap_Curve {
+    TONEMAP_CLAMP,    // anything past 1 is just 1
+    TONEMAP_REINHARD  // x / (1 + x), bright things roll off instead of clipping
+} Tonemap_Curve;
+
+typedef struct Tonemap {
+    float exposure; // in stops, +1 is twice as bright
+    Tonemap_Curve curve;
+    float gamma;    // 1 is linear like color_to_pixel, 0 is the srgb curve
+
+    // for gamma other than 1, maps [0, 1] to the 8 bit value. made by
+    // tonemap_init
+    u8 lut[TONEMAP_LUT_SIZE];
+} Tonemap;
+
+float srgb_encode (float x) {
+    if (x <= 0.0031308f) return 12.92f * x;
+    return 1.055f * powf(x, 1.0f / 2.4f) - 0.055f;
+}
+
+void tonemap_init (Tonemap *tonemap, float exposure, Tonemap_Curve curve, float gamma) {
+    tonemap->exposure = exposure;
+    tonemap->curve = curve;
+    tonemap->gamma = gamma;
+
+    for (int i = 0; i < TONEMAP_LUT_SIZE; i++) {
+        float x = (float) i / (float) (TONEMAP_LUT_SIZE - 1);
+        float y = gamma == 0.0f ? srgb_encode(x) : powf(x, 1.0f / gamma);
+        tonemap->lut[i] = (u8) (y * 255.0f + 0.5f);
+    }
+}
+
+FORCE_INLINE __m128 tonemap_load (const Color *colors, int i, int count) {
+    if (i >= count) return _mm_setzero_ps();
+    return _mm_setr_ps(colors[i].r, colors[i].g, colors[i].b, 0.0f);
+}
+
+// pixels[i] = the tone mapped colors[i], for count pixels
+void tonemap_pixels (const Tonemap *tonemap, const Color *colors, u32 *pixels, int count) {
+    __m128 scale = _mm_set1_ps(exp2f(tonemap->exposure));
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.0f);
+    bool linear = tonemap->gamma == 1.0f;
+    __m128 range = _mm_set1_ps(linear ? 255.0f : (float) (TONEMAP_LUT_SIZE - 1));
+
+    for (int i = 0; i < count; i += 4) {
+        __m128 r = tonemap_load(colors, i, count);
+        __m128 g = tonemap_load(colors, i + 1, count);
+        __m128 b = tonemap_load(colors, i + 2, count);
+        __m128 a = tonemap_load(colors, i + 3, count);
+        _MM_TRANSPOSE4_PS(r, g, b, a);
+
+        __m128 channels[3] = { r, g, b };
+        __m128i values[3];
+
+        for (int c = 0; c < 3; c++) {
+            __m128 v = _mm_mul_ps(channels[c], scale);
+            if (tonemap->curve == TONEMAP_REINHARD) v = _mm_div_ps(v, _mm_add_ps(v, one));
+            v = _mm_min_ps(_mm_max_ps(v, zero), one);
+
+            // linear truncates like color_to_pixel does, the lut index rounds
+            v = _mm_mul_ps(v, range);
+            values[c] = linear ? _mm_cvttps_epi32(v) : _mm_cvtps_epi32(v);
+        }
+
+        if (!linear) {
+            ALIGN16 s32 index[3][4];
+            for (int c = 0; c < 3; c++) {
+                _mm_store_si128((__m128i *) index[c], values[c]);
+                for (int lane = 0; lane < 4; lane++) index[c][lane] = tonemap->lut[index[c][lane]];
+                values[c] = _mm_load_si128((__m128i *) index[c]);
+            }
+        }
+
+        __m128i packed = _mm_or_si128(
+            _mm_or_si128(_mm_slli_epi32(values[0], 16), _mm_slli_epi32(values[1], 8)),
+            values[2]
+        );
+
+        if (i + 4 <= count) {
+            _mm_storeu_si128((__m128i *) &pixels[i], packed);
+        } else {
+            ALIGN16 u32 last[4];
+            _mm_store_si128((__m128i *) last, packed);
+            for (int lane = 0; i + lane < count; lane++) pixels[i + lane] = last[lane];
+        }
+    }
+}
@@ -0,0 +1,390 @@
+// wavefront rendering. ray_color follows each ray all the way down before the
+// next pixel starts, which keeps jumping between every object and light in
+// the scene. here all the rays of one bounce go into a queue, the queue gets
+// sorted so rays that start close together and point the same way are next to
+// each other, then the whole queue is intersected, then the shadow rays for
+// all those hits are traced, and then everything is shaded which fills the
+// queue for the next bounce.
+//
+// the depth first version clamps after every color_add. here the light a hit
+// gets directly is clamped the same way color_from_all_lights does it, but
+// light coming back from further bounces is added up and only clamped at the
+// end, so really bright reflections can come out a bit different. with hdr
+// on nothing gets clamped at all
+
+typedef struct Wave_Ray {
+    Ray ray;
+    Color weight; // how much of what this ray sees ends up in the pixel
+    int pixel;
+    int depth;
+} Wave_Ray;
+
+typedef struct Wave_Hit {
+    int object; // -1 if nothing was hit
+    const Material *material;
+    Vector3 point;
+    Vector3 normal;
+} Wave_Hit;
+
+typedef struct Shadow_Ray {
+    Vector3 point;
+    int hit;
+    int light;
+} Shadow_Ray;
+
+typedef struct Wave_Queue {
+    Wave_Ray *rays;
+    int count;
+    int capacity;
+} Wave_Queue;
+
+void wave_push (Wave_Queue *queue, Wave_Ray ray) {
+    if (queue->count == queue->capacity) {
+        queue->capacity = queue->capacity ? queue->capacity * 2 : 1024;
+        queue->rays = realloc(queue->rays, queue->capacity * sizeof(Wave_Ray));
+    }
+    queue->rays[queue->count++] = ray;
+}
+
+// ray sorting
+
+// spreads the low 10 bits of v out so there are two zero bits between each
+u64 morton_spread (u32 v) {
+    u64 x = v & 0x3FF;
+    x = (x | (x << 16)) & 0x30000FF;
+    x = (x | (x << 8))  & 0x300F00F;
+    x = (x | (x << 4))  & 0x30C30C3;
+    x = (x | (x << 2))  & 0x9249249;
+    return x;
+}
+
+// 30 bit morton code, points close together in 3d get codes close together
+u64 morton3 (u32 x, u32 y, u32 z) {
+    return morton_spread(x) | (morton_spread(y) << 1) | (morton_spread(z) << 2);
+}
+
+// maps a to 0-1023 where min goes to 0 and min + 1/scale goes to 1023
+u32 morton_quantize (float a, float min, float scale) {
+    float q = (a - min) * scale * 1023.0f;
+    if (q < 0.0f) q = 0.0f;
+    if (q > 1023.0f) q = 1023.0f;
+    return (u32) q;
+}
+
+// box around a bunch of points so their morton codes use all the bits
+typedef struct Morton_Bounds {
+    Vector3 min;
+    Vector3 scale; // 1 / size of the box
+} Morton_Bounds;
+
+Morton_Bounds morton_bounds (Vector3 min, Vector3 max) {
+    Morton_Bounds bounds;
+    bounds.min = min;
+    bounds.scale = (Vector3) {
+        max.x > min.x ? 1.0f / (max.x - min.x) : 0.0f,
+        max.y > min.y ? 1.0f / (max.y - min.y) : 0.0f,
+        max.z > min.z ? 1.0f / (max.z - min.z) : 0.0f,
+    };
+    return bounds;
+}
+
+u64 morton_point (Vector3 p, Morton_Bounds bounds) {
+    return morton3(
+        morton_quantize(p.x, bounds.min.x, bounds.scale.x),
+        morton_quantize(p.y, bounds.min.y, bounds.scale.y),
+        morton_quantize(p.z, bounds.min.z, bounds.scale.z)
+    );
+}
+
+u64 morton_direction (const Render_State *state, Vector3 dir) {
+    dir = shade_normalize(state, dir);
+    return morton3(
+        morton_quantize(dir.x, -1.0f, 0.5f),
+        morton_quantize(dir.y, -1.0f, 0.5f),
+        morton_quantize(dir.z, -1.0f, 0.5f)
+    );
+}
+
+// lsd radix sort 8 bits at a time, the keys end up sorted and order gets the
+// original index of each one. passes where every key has the same byte get
+// skipped, which is most of them for small batches
+void radix_sort_keys (u64 *keys, u32 *order, int count) {
+    u64 *tmp_keys = malloc(count * sizeof(u64));
+    u32 *tmp_order = malloc(count * sizeof(u32));
+
+    u64 *src_keys = keys, *dst_keys = tmp_keys;
+    u32 *src_order = order, *dst_order = tmp_order;
+
+    for (int i = 0; i < count; i++) order[i] = i;
+
+    for (int shift = 0; shift < 64 && count > 0; shift += 8) {
+        int counts[256] = {0};
+        for (int i = 0; i < count; i++) counts[(src_keys[i] >> shift) & 255]++;
+
+        if (counts[(src_keys[0] >> shift) & 255] == count) continue;
+
+        int offset = 0;
+        for (int b = 0; b < 256; b++) {
+            int c = counts[b];
+            counts[b] = offset;
+            offset += c;
+        }
+
+        for (int i = 0; i < count; i++) {
+            int dest = counts[(src_keys[i] >> shift) & 255]++;
+            dst_keys[dest] = src_keys[i];
+            dst_order[dest] = src_order[i];
+        }
+
+        u64 *k = src_keys; src_keys = dst_keys; dst_keys = k;
+        u32 *o = src_order; src_order = dst_order; dst_order = o;
+    }
+
+    if (src_keys != keys) {
+        memcpy(keys, src_keys, count * sizeof(u64));
+        memcpy(order, src_order, count * sizeof(u32));
+    }
+
+    free(tmp_keys);
+    free(tmp_order);
+}
+
+// sorts the rays by where they start and then which way they go
+void sort_wave_rays (const Render_State *state, Wave_Queue *queue) {
+    int count = queue->count;
+    if (count < 2) return;
+
+    Vector3 min = queue->rays[0].ray.pos;
+    Vector3 max = min;
+    for (int i = 1; i < count; i++) {
+        Vector3 p = queue->rays[i].ray.pos;
+        min = (Vector3) {fminf(min.x, p.x), fminf(min.y, p.y), fminf(min.z, p.z)};
+        max = (Vector3) {fmaxf(max.x, p.x), fmaxf(max.y, p.y), fmaxf(max.z, p.z)};
+    }
+    Morton_Bounds bounds = morton_bounds(min, max);
+
+    u64 *keys = malloc(count * sizeof(u64));
+    u32 *order = malloc(count * sizeof(u32));
+
+    for (int i = 0; i < count; i++) {
+        Ray ray = queue->rays[i].ray;
+        keys[i] = (morton_point(ray.pos, bounds) << 30) | morton_direction(state, ray.dir);
+    }
+
+    radix_sort_keys(keys, order, count);
+
+    Wave_Ray *sorted = malloc(queue->capacity * sizeof(Wave_Ray));
+    for (int i = 0; i < count; i++) sorted[i] = queue->rays[order[i]];
+
+    free(queue->rays);
+    queue->rays = sorted;
+
+    free(keys);
+    free(order);
+}
+
+// shadow rays get grouped by light first, then by where they start
+void sort_shadow_rays (Shadow_Ray *shadows, int count) {
+    if (count < 2) return;
+
+    Vector3 min = shadows[0].point;
+    Vector3 max = min;
+    for (int i = 1; i < count; i++) {
+        Vector3 p = shadows[i].point;
+        min = (Vector3) {fminf(min.x, p.x), fminf(min.y, p.y), fminf(min.z, p.z)};
+        max = (Vector3) {fmaxf(max.x, p.x), fmaxf(max.y, p.y), fmaxf(max.z, p.z)};
+    }
+    Morton_Bounds bounds = morton_bounds(min, max);
+
+    u64 *keys = malloc(count * sizeof(u64));
+    u32 *order = malloc(count * sizeof(u32));
+
+    for (int i = 0; i < count; i++) {
+        keys[i] = ((u64) shadows[i].light << 30) | morton_point(shadows[i].point, bounds);
+    }
+
+    radix_sort_keys(keys, order, count);
+
+    Shadow_Ray *sorted = malloc(count * sizeof(Shadow_Ray));
+    for (int i = 0; i < count; i++) sorted[i] = shadows[order[i]];
+    memcpy(shadows, sorted, count * sizeof(Shadow_Ray));
+
+    free(sorted);
+    free(keys);
+    free(order);
+}
+
+// shading
+
+bool color_is_black (Color color) {
+    return color.r <= 0.0f && color.g <= 0.0f && color.b <= 0.0f;
+}
+
+// adds the light the hit gets straight from the lights to its pixel and puts
+// any mirror or refraction rays it makes into next
+void shade_wave_hit (
+    const Render_State *state, Wave_Ray *wave_ray, Wave_Hit *hit, float *visible, Color *colors, Wave_Queue *next
+) {
+    Ray sight = wave_ray->ray;
+    const Material *material = hit->material;
+    Object object = state->scene[hit->object];
+
+    if (material->refract) {
+        // no lighting on refractive things, same as in ray_color
+        float transmission = fresnel_transmission(state, sight, hit->normal, material->refract_amount);
+
+        Wave_Ray refraction = *wave_ray;
+        refraction.ray = refract_ray(state, sight, hit->point, hit->normal, material->refract_amount, object);
+        refraction.weight = color_scale(wave_ray->weight, transmission);
+        refraction.depth = wave_ray->depth + 2;
+        if (!color_is_black(refraction.weight)) wave_push(next, refraction);
+
+        Wave_Ray reflection = *wave_ray;
+        reflection.ray = reflect_ray(state, sight, hit->point, hit->normal);
+        reflection.weight = color_scale(wave_ray->weight, 1.0f - transmission);
+        reflection.depth = wave_ray->depth + 1;
+        if (!color_is_black(reflection.weight)) wave_push(next, reflection);
+
+        return;
+    }
+
+    // in ray_color a mirror's color is lerp(color, mirror_color, mirror) and
+    // that gets lit, so the reflection ray's weight is the diffuse light
+    // times mirror and the rest is lit here
+    Color surface_color = color_scale(material->color, 1.0f - material->mirror);
+    Color local = {0};
+    Color diffuse_total = {0};
+
+    for (int l = 0; l < ARRAY_LEN(state->lights); l++) {
+        if (visible[l] <= 0.0f) continue;
+
+        Color diffuse_comp = diffuse_from_light(state, state->lights[l], object, hit->point, hit->normal);
+        Color diffuse = color_scale(diffuse_comp, material->diffuseness * visible[l]);
+
+        Color specular_comp = specular_from_light(
+            state, state->lights[l], object, hit->point, hit->normal, sight, *material);
+        Color specular = color_scale(specular_comp, material->specularness * visible[l]);
+
+        local = color_add_light(state, local, color_mul(diffuse, surface_color));
+        local = color_add_light(state, local, specular);
+
+        diffuse_total = color_sum(diffuse_total, diffuse);
+    }
+
+    colors[wave_ray->pixel] = color_sum(colors[wave_ray->pixel], color_mul(wave_ray->weight, local));
+
+    if (material->mirror > 0.0f) {
+        Wave_Ray reflection = *wave_ray;
+        reflection.ray = reflect_ray(state, sight, hit->point, hit->normal);
+        reflection.weight = color_mul(wave_ray->weight, color_scale(diffuse_total, material->mirror));
+        reflection.depth = wave_ray->depth + 1;
+        if (!color_is_black(reflection.weight)) wave_push(next, reflection);
+    }
+}
+
+// same as trace_block but breadth first, colors is row major and
+// block_width*block_height long
+void trace_wavefront (
+    const Render_State *state, Color *colors,
+    int x0, int y0, int block_width, int block_height,
+    int width, int height, int samples
+) {
+    int pixel_count = block_width * block_height;
+    for (int i = 0; i < pixel_count; i++) colors[i] = (Color) {0};
+
+    Wave_Queue queue = {0};
+    Wave_Queue next = {0};
+
+    float sample_weight = 1.0f / (float) (samples*samples);
+    for (int sample = 0; sample < samples * samples; sample++) {
+        for (int i = 0; i < pixel_count; i++) {
+            Wave_Ray primary;
+            primary.ray = primary_ray(
+                state, x0 + i % block_width, y0 + i / block_width, width, height, sample, samples);
+            primary.weight = (Color) {sample_weight, sample_weight, sample_weight};
+            primary.pixel = i;
+            primary.depth = 0;
+            wave_push(&queue, primary);
+        }
+    }
+
+    int light_count = ARRAY_LEN(state->lights);
+    Wave_Hit *hits = NULL;
+    Shadow_Ray *shadows = NULL;
+    float *visible = NULL;
+    int hit_capacity = 0;
+
+    while (queue.count > 0) {
+        sort_wave_rays(state, &queue);
+
+        if (queue.count > hit_capacity) {
+            hit_capacity = queue.capacity;
+            hits = realloc(hits, hit_capacity * sizeof(Wave_Hit));
+            shadows = realloc(shadows, hit_capacity * light_count * sizeof(Shadow_Ray));
+            visible = realloc(visible, hit_capacity * light_count * sizeof(float));
+        }
+
+        // intersect everything
+        for (int i = 0; i < queue.count; i++) {
+            Wave_Ray *wave_ray = &queue.rays[i];
+            Wave_Hit *hit = &hits[i];
+            hit->object = -1;
+
+            // too deep, ray_color gives back white for these
+            if (wave_ray->depth > 20) {
+                colors[wave_ray->pixel] = color_sum(colors[wave_ray->pixel], wave_ray->weight);
+                continue;
+            }
+
+            float t;
+            if (intersect_scene(state, wave_ray->ray, 0.0f, INFINITY, &t, &hit->object, &hit->normal)) {
+                hit->point = parametric_line(t, wave_ray->ray);
+                hit->material = object_material_ref(state, &state->scene[hit->object], hit->point);
+            }
+        }
+
+        // shadow rays for everything that gets lit
+        int shadow_count = 0;
+        for (int i = 0; i < queue.count; i++) {
+            if (hits[i].object < 0 || hits[i].material->refract) continue;
+
+            for (int l = 0; l < light_count; l++) {
+                shadows[shadow_count++] = (Shadow_Ray) {
+                    .point = hits[i].point,
+                    .hit = i,
+                    .light = l
+                };
+            }
+        }
+
+        sort_shadow_rays(shadows, shadow_count);
+
+        for (int i = 0; i < shadow_count; i++) {
+            Shadow_Ray shadow = shadows[i];
+            visible[shadow.hit * light_count + shadow.light] = light_visibility(state, state->lights[shadow.light], shadow.point);
+        }
+
+        // shade, which makes the next bounce
+        next.count = 0;
+        for (int i = 0; i < queue.count; i++) {
+            if (hits[i].object < 0) continue;
+            shade_wave_hit(state, &queue.rays[i], &hits[i], &visible[i * light_count], colors, &next);
+        }
+
+        Wave_Queue swap = queue;
+        queue = next;
+        next = swap;
+    }
+
+    for (int i = 0; i < pixel_count && !state->hdr; i++) {
+        colors[i].r = fclamp(colors[i].r, 1.0f, 0.0f);
+        colors[i].g = fclamp(colors[i].g, 1.0f, 0.0f);
+        colors[i].b = fclamp(colors[i].b, 1.0f, 0.0f);
+    }
+
+    free(queue.rays);
+    free(next.rays);
+    free(hits);
+    free(shadows);
+    free(visible);
+}
@@ -1,19 +1,4 @@
 #include <windows.h>
-#include <stdint.h>
-#include <stdbool.h>
-
-typedef uint8_t  u8;
-typedef uint16_t u16;
-typedef uint32_t u32;
-typedef uint64_t u64;
-
-typedef int8_t  s8;
-typedef int16_t s16;
-typedef int32_t s32;
-typedef int64_t s64;
-
-typedef float r32;
-typedef double r64;
 
 typedef struct Win32_Offscreen_Buffer {
     BITMAPINFO info;
@@ -30,7 +15,9 @@ typedef struct Win32_Window_Dimension {
 } Win32_Window_Dimension;
 
 Win32_Offscreen_Buffer global_backbuffer;
-bool global_running;
+Win32_Offscreen_Buffer global_frontbuffer;
+volatile bool global_running; // the tracer and presenter threads read this too
+HANDLE global_redraw; // auto reset event that gets the presenter thread to draw the window
 
 inline Win32_Window_Dimension win32_get_window_dimension (HWND window) {
     Win32_Window_Dimension result;
@@ -139,22 +126,11 @@ win32_main_window_callback(
         } break;
 
         case WM_PAINT: {
+            // the presenter thread does the actual drawing
             PAINTSTRUCT paint;
-            HDC device_context = BeginPaint(window, &paint);
-
-            int x = paint.rcPaint.left;
-            int y = paint.rcPaint.top;
-            int width = paint.rcPaint.right - paint.rcPaint.left;
-            int height = paint.rcPaint.bottom - paint.rcPaint.top;
-
-            RECT client_rect;
-            GetClientRect(window, &client_rect);
-
-            Win32_Window_Dimension dimension = win32_get_window_dimension(window);
-            win32_display_buffer_in_window(device_context, dimension.width, dimension.height, &global_backbuffer, x, y, width, height);
-
+            BeginPaint(window, &paint);
             EndPaint(window, &paint);
-            //OutputDebugStringA("WM_PAINT\n");
+            SetEvent(global_redraw);
         } break;
 
         case WM_SYSKEYDOWN: